@@ -33,26 +33,58 @@
 //
 
 #include <filei.h>
+#include <finput.h>
+#include <fmd5.h>
+#include <fprobe.h>
 
 extern "C" {
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include <openssl/md5.h>
 }
 
-#include <fstream>
-
 void* (*filei::_gbuff)(size_t) = &filei::gbuff;
 size_t (*filei::_buffc)() = &filei::buffc;
 void (*filei::_relbuff)(void*) = 0;
 char filei::_buffer[__UABUFFSIZE];
-     
+filei::iomode_t filei::_iomode = filei::IO_BUFFERED;
+bool filei::_sparse = false;
+int filei::_tree = 0;
+void (*filei::_rdhook)(size_t) = 0;
+
+// the unit of zero runs in sparse hashes
+static const size_t __zblock = 4096;
+
+// an all zero block
+static const char __zeros[__zblock] = { 0 };
+
 filei::filei(const std::string& path, bool ic, bool iw, size_t m, size_t bs)
 throw(const char*):_path(path),_h(0)  {
    ::bzero(_md5,16); // zero out
-   calc(ic,iw,bs,m);
+   double t = fprobe::_on ? fprobe::now() : 0;
+   if (!(_tree && !_sparse && !iw && !m && calct(ic))) {
+      ffile is(path,m);
+      calc(is,ic,iw,bs,m);
+   }
+   if (fprobe::_on) fprobe::add(fprobe::HASH,fprobe::now() - t,path.c_str());
+}
+
+filei::filei(const std::string& path, finput& is, bool ic, bool iw, 
+   size_t m, size_t bs) throw(const char*):_path(path),_h(0)  {
+   ::bzero(_md5,16); // zero out
+   calc(is,ic,iw,bs,m);
+}
+
+filei::filei(const std::string& path, const unsigned char* md5):
+_path(path),_h(0) {
+   ::memcpy(_md5,md5,16);
+   hash();
 }
 
 // in-place turn buffer into lower case
@@ -98,15 +130,317 @@ static int __remove_white(char* buffer, int n) {
    return r;
 }
 
-void filei::calc(bool ic, bool iw, size_t bn, size_t m) throw(const char*) {
+// sparse hash context
+//
+// The bytes are cut into aligned blocks of __zblock; runs of all zero
+// blocks go to the layout (as position and length), everything else is
+// the data. The hash is the md5 of the md5 of the data and the md5 of the
+// layout (ending with the total length), so it only depends on the bytes,
+// not on whether the zeros were read or known to be a hole.
+//
+class __sparsemd5 {
+   private:
+      MD5_CTX _d;  // data
+      MD5_CTX _l;  // layout
+      bool _ic;    // ignore case
+      bool _ok;    // no md5 errors
+      char _blk[__zblock]; // the block being assembled
+      size_t _bn;  // bytes in _blk
+      off_t _pos;  // offset of the next block
+      off_t _zs;   // start of the current zero run
+      off_t _zn;   // length of the current zero run
+
+      // record a number in the layout
+      void layout(off_t x) {
+         unsigned char b[8];
+         for(int i = 0; i < 8; ++i, x >>= 8) b[i] = (unsigned char)(x & 0xff);
+         _ok = MD5_Update(&_l,b,8) && _ok;
+      }
+
+      // end the current zero run
+      void flush() {
+         if (_zn) layout(_zs), layout(_zn);
+         _zn = 0;
+      }
+
+      // zero blocks at _pos
+      void zeros(off_t n) {
+         if (!_zn || _zs + _zn != _pos) flush(), _zs = _pos;
+         _zn += n;
+         _pos += n;
+      }
+
+      // a complete block (or the final partial one) at _pos
+      void block(char* p, size_t n) {
+         if (n == __zblock && !::memcmp(p,__zeros,n)) { zeros(n); return; }
+         flush();
+         if (_ic) __lower_case(p,n);
+         _ok = MD5_Update(&_d,p,n) && _ok;
+         _pos += n;
+      }
+
+   public:
+
+      __sparsemd5(bool ic): _ic(ic), _bn(0), _pos(0), _zs(0), _zn(0) {
+         _ok = MD5_Init(&_d) && MD5_Init(&_l);
+      }
+
+      // the next bytes
+      void feed(char* p, size_t n) {
+         while(n) {
+            if (!_bn && n >= __zblock) {
+               block(p,__zblock);
+               p += __zblock, n -= __zblock;
+               continue;
+            }
+            size_t k = std::min(__zblock - _bn,n);
+            ::memcpy(_blk + _bn,p,k);
+            _bn += k, p += k, n -= k;
+            if (_bn == __zblock) block(_blk,__zblock), _bn = 0;
+         }
+      }
+
+      // the next bytes are known to be zero (a hole)
+      void hole(off_t n) {
+         if (_bn) { // complete the partial block
+            size_t k = (size_t)std::min((off_t)(__zblock - _bn),n);
+            ::memset(_blk + _bn,0,k);
+            _bn += k, n -= k;
+            if (_bn < __zblock) return;
+            block(_blk,__zblock), _bn = 0;
+         }
+         off_t z = n / __zblock * __zblock;
+         if (z) zeros(z);
+         ::memset(_blk,0,_bn = n - z);
+      }
+
+      // the hash
+      bool final(unsigned char* md5) {
+         if (_bn) block(_blk,_bn);
+         flush();
+         layout(_pos);
+
+         unsigned char dl[32];
+         MD5_CTX c;
+         return MD5_Final(dl,&_d) && MD5_Final(dl + 16,&_l) && _ok &&
+            MD5_Init(&c) && MD5_Update(&c,dl,32) && MD5_Final(md5,&c);
+      }
+};
+
+// a tree hash being calculated
+struct __tjob {
+   int fd;               // the file
+   bool direct;          // opened with O_DIRECT
+   off_t size;           // its size
+   bool ic;              // ignore case
+   size_t n;             // number of chunks
+   unsigned char* md5s;  // hashes of the chunks
+   size_t next;          // next chunk to hash
+   const char* error;    // first error
+   pthread_mutex_t m;    // guards next and error
+};
+
+// hash chunks of a tree hash until there are none left
+static void* __tchunks(void* p) {
+   __tjob& j = *static_cast<__tjob*>(p);
+
+   char* buff = 0;
+   if (::posix_memalign((void**)&buff,__UAIOALIGN,__UAIOWINDOW)) {
+      ::pthread_mutex_lock(&j.m);
+      j.error = "Could not allocate memory";
+      ::pthread_mutex_unlock(&j.m);
+      return 0;
+   }
+
+   for(;;) {
+      ::pthread_mutex_lock(&j.m);
+      size_t c = j.next++;
+      bool done = j.error || c >= j.n;
+      ::pthread_mutex_unlock(&j.m);
+      if (done) break;
+
+      off_t b = (off_t)c * __UATREECHUNK;
+      off_t e = std::min(b + (off_t)__UATREECHUNK,j.size);
+
+      const char* error = 0;
+      MD5_CTX ctxt;
+      if (!MD5_Init(&ctxt)) error = "Could not init MD5";
+
+      for(off_t o = b; !error && o < e;) {
+         size_t k = (size_t)std::min((off_t)__UAIOWINDOW,e - o);
+         // O_DIRECT reads whole blocks, the tail is short
+         size_t kr = j.direct ? (k + __UAIOALIGN - 1) & ~(__UAIOALIGN - 1) : k;
+         double t = fprobe::_on ? fprobe::now() : 0;
+         ssize_t r = ::pread(j.fd,buff,kr,o);
+         if (fprobe::_on) fprobe::add(fprobe::READ,fprobe::now() - t);
+         __UAPROBE2(read__done,j.fd,r);
+         if (r < 0 && errno == EINTR) continue;
+         if (r <= 0) { error = "Could not read file"; break; }
+         if (filei::_rdhook) (*filei::_rdhook)(r);
+         if ((size_t)r > k) r = k;
+         if (j.ic) __lower_case(buff,r);
+         if (!MD5_Update(&ctxt,buff,r)) error = "MD5 calc error";
+         o += r;
+      }
+      if (!error && !MD5_Final(j.md5s + 16 * c,&ctxt)) 
+         error = "MD5 calc error (final)";
+
+      if (filei::_iomode != filei::IO_BUFFERED) 
+         ::posix_fadvise(j.fd,b,e - b,POSIX_FADV_DONTNEED);
+
+      if (error) {
+         ::pthread_mutex_lock(&j.m);
+         if (!j.error) j.error = error;
+         ::pthread_mutex_unlock(&j.m);
+      }
+   }
+
+   ::free(buff);
+   return 0;
+}
+
+bool filei::calct(bool ic) throw(const char*) {
+   // decide on the size before opening, small files take the per-file path
+   struct stat fsi;
+   if (::stat(_path.c_str(),&fsi) || !S_ISREG(fsi.st_mode) ||
+      fsi.st_size <= (off_t)__UATREECHUNK) return false;
+
+   __tjob j;
+   j.direct = _iomode == IO_DIRECT;
+   __UAPROBE1(open__start,_path.c_str());
+   double t = fprobe::_on ? fprobe::now() : 0;
+   j.fd = ::open(_path.c_str(),O_RDONLY | (j.direct ? O_DIRECT : 0));
+   if (j.fd < 0 && j.direct && errno == EINVAL) {
+      j.direct = false;
+      j.fd = ::open(_path.c_str(),O_RDONLY);
+   }
+   if (fprobe::_on) fprobe::add(fprobe::OPEN,fprobe::now() - t);
+   __UAPROBE2(open__done,_path.c_str(),j.fd);
+   if (j.fd < 0) throw "Could not open file";
+
+   j.size = fsi.st_size;
+   j.ic = ic;
+   j.n = (j.size + __UATREECHUNK - 1) / __UATREECHUNK;
+   std::vector<unsigned char> md5s(16 * j.n);
+   j.md5s = &md5s[0];
+   j.next = 0;
+   j.error = 0;
+   ::pthread_mutex_init(&j.m,0);
+
+   // this thread hashes chunks too
+   std::vector<pthread_t> ts;
+   for(int i = 1; i < _tree && i < (int)j.n; ++i) {
+      pthread_t t;
+      if (::pthread_create(&t,0,&__tchunks,&j)) break;
+      ts.push_back(t);
+   }
+   __tchunks(&j);
+   for(int i = 0; i < (int)ts.size(); ++i) ::pthread_join(ts[i],0);
+
+   ::pthread_mutex_destroy(&j.m);
+   ::close(j.fd);
+   if (j.error) throw j.error;
+
+   // the root: md5 of the chunk hashes and the length
+   unsigned char len[8];
+   off_t x = j.size;
+   for(int i = 0; i < 8; ++i, x >>= 8) len[i] = (unsigned char)(x & 0xff);
+
+   MD5_CTX ctxt;
+   if (!MD5_Init(&ctxt) || !MD5_Update(&ctxt,j.md5s,16 * j.n) ||
+      !MD5_Update(&ctxt,len,8) || !MD5_Final(_md5,&ctxt)) 
+      throw "MD5 calc error (final)";
+
+   __UAPROBE2(digest,_path.c_str(),_md5);
+   hash();
+   return true;
+}
+
+void filei::calcs(finput& is, bool ic, size_t bn, size_t m) 
+throw(const char*) {
+
+   const char* error = 0;
+
+   char* buffer = 0;
+   off_t pos = 0;
+
+   ffile* f = dynamic_cast<ffile*>(&is); // holes are known for files
+   __sparsemd5 ctxt(ic);
+
+   __UAPROBE2(calc__start,_path.c_str(),m);
+
+   if (!is.good()) { error = "Could not open file"; goto FINALLY; }
+
+   try {
+      bn = std::max(bn,__zblock);
+      buffer= static_cast<char*>((*_gbuff)(bn));   // get buffer
+      if (!buffer) throw 1;
+   } catch(...) {
+      error = "Could not allocate memory";
+      goto FINALLY;
+   }
+
+   bn = _buffc ? std::min(bn,(*_buffc)()) : bn;  // get buffer size
+
+   try {
+      for(;;) {
+         off_t lim = m ? (off_t)m - pos : 0;   // 0: no limit
+         if (m && lim <= 0) break;
+
+         bool hole = false;
+         off_t end = f ? f->extent(hole) : pos + bn;
+         if (end <= pos) break;
+
+         off_t r = m ? std::min(end - pos,lim) : end - pos;
+         if (hole) {
+            ctxt.hole(r);
+            f->skip(r);
+            pos += r;
+            continue;
+         }
+
+         // don't read into the next hole
+         size_t n = (size_t)std::min((off_t)bn,r);
+         size_t k = is.read(buffer,n);
+         ctxt.feed(buffer,k);
+         pos += k;
+         if (k < n) break;
+      }
+   } catch(const char* e) {
+      error = e;
+      goto FINALLY;
+   }
+
+   if (!ctxt.final(_md5)) { 
+      error= "MD5 calc error (final)";
+      goto FINALLY; 
+   }
+
+   __UAPROBE2(calc__done,_path.c_str(),pos);
+   __UAPROBE2(digest,_path.c_str(),_md5);
+   hash();
+
+FINALLY:
+
+   // clean-up
+   if (_relbuff) (*_relbuff)(buffer);
+
+   if (error) throw error;
+}
+
+void filei::calc(finput& is, bool ic, bool iw, size_t bn, size_t m) 
+throw(const char*) {
    
+   if (_sparse && !iw) { calcs(is,ic,bn,m); return; }
+
    const char* error = 0;
 
    char* buffer = 0;
    size_t tot = 0;
-   
-   std::ifstream is(_path.c_str());
+   size_t hashed = 0;
 
+   __UAPROBE2(calc__start,_path.c_str(),m);
+   
    if (!is.good()) { error = "Could not open file"; goto FINALLY; }
 
    try {
@@ -124,8 +458,7 @@ void filei::calc(bool ic, bool iw, size_t bn, size_t m) throw(const char*) {
 
 
    for(bool done=false;!done;) {
-      is.read(buffer,bn);
-      size_t n = is.gcount();
+      size_t n = is.read(buffer,bn);
       if (!n) break;
 
       if (ic) __lower_case(buffer,n);
@@ -145,6 +478,7 @@ void filei::calc(bool ic, bool iw, size_t bn, size_t m) throw(const char*) {
           error = "MD5 calc error"; 
           goto FINALLY; 
       }
+      hashed += n;
       if (is.eof()) break;
    }
 
@@ -153,20 +487,114 @@ void filei::calc(bool ic, bool iw, size_t bn, size_t m) throw(const char*) {
       goto FINALLY; 
    }
 
-   for(int i = 0, s = 0; i < 16; ++i, ++s) {
-      if (s >= (int)sizeof(size_t)) s = 0;
-      _h ^= ((size_t)_md5[i]) << (s << 3);
+   __UAPROBE2(calc__done,_path.c_str(),hashed);
+   __UAPROBE2(digest,_path.c_str(),_md5);
+   hash();
+
+FINALLY:
+
+   // clean-up
+   if (_relbuff) (*_relbuff)(buffer);
+
+   if (error) throw error;
+}
+
+void filei::variants(const std::string& path, size_t m, size_t bn,
+   std::vector<filei>& fis) throw(const char*) {
+
+   const char* error = 0;
+   double t = fprobe::_on ? fprobe::now() : 0;
+
+   char* buffer = 0;
+   MD5_CTX ctxt[4];
+   unsigned char md5[4][16];
+   size_t tot[4] = { 0, 0, 0, 0 };
+   bool done[4] = { false, false, false, false };
+   int left = 4; // hashes not done
+   size_t hashed = 0;
+
+   __UAPROBE2(calc__start,path.c_str(),m);
+
+   // without white spaces, the first m bytes may be further than m
+   ffile is(path,0);
+   if (!is.good()) { error = "Could not open file"; goto FINALLY; }
+
+   try {
+      buffer= static_cast<char*>((*_gbuff)(bn << 2));   // get buffer
+      if (!buffer) throw 1;
+   } catch(...) {
+      error = "Could not allocate memory";
+      goto FINALLY;
+   }
+
+   bn = _buffc ? std::min(bn << 2,(*_buffc)()) >> 2 : bn; // one per hash
+
+   for(int k = 0; k < 4; ++k) {
+      if (!MD5_Init(ctxt + k)) { error = "Could not init MD5"; goto FINALLY; }
+   }
+
+   try {
+      while(left) {
+         size_t n = is.read(buffer,bn);
+         if (!n) break;
+         hashed += n;
+
+         // the raw bytes, lower case, no white spaces, both
+         char* b[4] = { buffer, buffer + bn, buffer + 2*bn, buffer + 3*bn };
+         size_t l[4] = { n, n, n, n };
+         ::memcpy(b[1],buffer,n);
+         __lower_case(b[1],n);
+         ::memcpy(b[2],buffer,n);
+         l[2] -= __remove_white(b[2],n);
+         ::memcpy(b[3],b[1],n);
+         l[3] -= __remove_white(b[3],n);
+
+         for(int k = 0; k < 4; ++k) {
+            if (done[k] || !l[k]) continue;
+            if (m) {
+               if (tot[k] + l[k] >= m) {
+                  l[k] = m - tot[k];
+                  done[k] = true;
+                  --left;
+               } else tot[k] += l[k];
+            }
+            if (!MD5_Update(ctxt + k,b[k],l[k])) throw "MD5 calc error";
+         }
+         if (is.eof()) break;
+      }
+   } catch(const char* e) {
+      error = e;
+      goto FINALLY;
+   }
+
+   for(int k = 0; k < 4; ++k) {
+      if (!MD5_Final(md5[k],ctxt + k)) {
+         error= "MD5 calc error (final)";
+         goto FINALLY;
+      }
    }
 
+   __UAPROBE2(calc__done,path.c_str(),hashed);
+   __UAPROBE2(digest,path.c_str(),md5[0]);
+   for(int k = 0; k < 4; ++k) fis.push_back(filei(path,md5[k]));
+   if (fprobe::_on) fprobe::add(fprobe::HASH,fprobe::now() - t,path.c_str());
+
 FINALLY:
 
    // clean-up
-   is.close();
    if (_relbuff) (*_relbuff)(buffer);
 
    if (error) throw error;
 }
 
+void filei::hash() {
+   _h = 0;
+   for(int i = 0, s = 0; i < 16; ++i, ++s) {
+      if (s >= (int)sizeof(size_t)) s = 0;
+      _h ^= ((size_t)_md5[i]) << (s << 3);
+   }
+}
+
 off_t filei::fsize(const std::string& path) throw(const char*) {
    struct stat fsi;
 
@@ -175,19 +603,25 @@ off_t filei::fsize(const std::string& path) throw(const char*) {
    return fsi.st_size;
 }
 
+void filei::prefetch(const std::string& path, size_t n) {
+   if (_iomode != IO_NOCACHE) return;
+
+   int fd = ::open(path.c_str(),O_RDONLY);
+   if (fd < 0) return;
+   ::readahead(fd,0,n ? n : __UAIOWINDOW);
+   ::close(fd);
+}
+
 static bool __bytesame(
-   std::istream& is1, std::istream& is2,
+   finput& is1, finput& is2,
    char* buff1, char* buff2, 
    size_t c1, size_t c2, size_t m) throw(const char*) {
 
    size_t tot1 = 0, tot2 = 0;
 
    for(;;) {
-      is1.read(buff1,c1);
-      is2.read(buff2,c2);
-
-      size_t n1 = is1.gcount();
-      size_t n2 = is2.gcount();
+      size_t n1 = is1.read(buff1,c1);
+      size_t n2 = is2.read(buff2,c2);
 
       if (m) {
          if (tot1 + n1 > m) n1 = m - tot1;
@@ -210,10 +644,9 @@ static bool __bytesame(
    return true;
 }
 
-static size_t __reload(std::istream& is, char* buff, size_t c, char*& p) {
-   is.read(buff,c);
+static size_t __reload(finput& is, char* buff, size_t c, char*& p) {
    p = buff;
-   return is.gcount();
+   return is.read(buff,c);
 }
 
 static void __tolower(char& c) {
@@ -226,16 +659,13 @@ static void __skipws(char*& p, const char* e) {
 }
 
 static bool __same(
-   std::istream& is1, std::istream& is2,
+   finput& is1, finput& is2,
    char* buff1, char* buff2, 
    size_t c1, size_t c2, size_t m,
-   bool ic, bool iw) {
-
-   is1.read(buff1,c1);
-   is2.read(buff2,c2);
+   bool ic, bool iw) throw(const char*) {
 
-   size_t n1 = is1.gcount();
-   size_t n2 = is2.gcount();
+   size_t n1 = is1.read(buff1,c1);
+   size_t n2 = is2.read(buff2,c2);
 
    char* p1 = buff1;
    char* p2 = buff2;
@@ -263,6 +693,176 @@ static bool __same(
    return true;
 }
 
+// compare extent by extent, holes are not read
+static bool __sparsesame(
+   ffile& is1, ffile& is2,
+   char* buff1, char* buff2, 
+   size_t c1, size_t c2, size_t m) throw(const char*) {
+
+   off_t s = is1.size();
+   if (s != is2.size()) {
+      if (!m || std::min(s,(off_t)m) != std::min(is2.size(),(off_t)m)) 
+         return false;
+   }
+   if (m) s = std::min(s,(off_t)m);
+
+   size_t c = std::min(c1,c2);
+
+   for(off_t pos = 0; pos < s;) {
+      bool h1, h2;
+      off_t e = std::min(std::min(is1.extent(h1),is2.extent(h2)),s);
+      if (e <= pos) break;
+      off_t n = e - pos;
+
+      if (h1 && h2) is1.skip(n), is2.skip(n);
+      else if (h1 || h2) { // the data of the other must be zero
+         ffile& d = h1 ? is2 : is1;
+         (h1 ? is1 : is2).skip(n);
+         for(off_t k = n; k > 0;) {
+            size_t r = d.read(buff1,(size_t)std::min((off_t)c,k));
+            if (!r) return false;
+            for(const char* p = buff1; p < buff1 + r; ++p) if (*p) return false;
+            k -= r;
+         }
+      } else {
+         for(off_t k = n; k > 0;) {
+            size_t w = (size_t)std::min((off_t)c,k);
+            size_t r1 = is1.read(buff1,w);
+            size_t r2 = is2.read(buff2,w);
+            if (r1 != r2 || ::memcmp(buff1,buff2,r1)) return false;
+            if (r1 < w) return true; // both ended early
+            k -= r1;
+         }
+      }
+      pos = e;
+   }
+
+   return true;
+}
+
+// a lane of filei::hashn
+struct __mlane {
+   int job;         // index of the file (-1: idle)
+   ffile* f;
+   unsigned char* buff;
+   size_t n;        // bytes in buff
+   size_t pos;      // next block in buff
+   uint64_t len;    // bytes hashed
+   bool last;       // buff ends with the padding
+   double t;        // when it was started (fprobe)
+};
+
+// start the next file that opens in a lane
+static void __mstart(__mlane& ln, fmd5& x, int l, 
+   const std::vector<std::string>& paths, size_t& next, size_t m,
+   std::vector<const char*>& errs) {
+   ln.job = -1;
+   while(next < paths.size()) {
+      int j = next++;
+      ln.t = fprobe::_on ? fprobe::now() : 0;
+      if (next < paths.size()) filei::prefetch(paths[next]);
+      ffile* f = new ffile(paths[j],m);
+      if (!f->good()) {
+         delete f;
+         errs[j] = "Could not open file";
+         continue;
+      }
+      ln.job = j, ln.f = f, ln.n = ln.pos = 0, ln.len = 0, ln.last = false;
+      x.init(l);
+      return;
+   }
+}
+
+// read the next buffer of a lane, and pad it at the end
+static void __mfill(__mlane& ln, bool ic, size_t m, size_t bn) 
+throw(const char*) {
+   size_t want = m ? std::min((uint64_t)bn,m - ln.len) : bn;
+   size_t k = want ? ln.f->read((char*)ln.buff,want) : 0;
+   if (ic) __lower_case((char*)ln.buff,k);
+   ln.len += k, ln.n = k, ln.pos = 0;
+   if (k == want && !ln.f->eof() && (!m || ln.len < m)) return;
+
+   uint64_t bits = ln.len << 3;
+   ln.buff[ln.n++] = 0x80;
+   while(ln.n % 64 != 56) ln.buff[ln.n++] = 0;
+   for(int i = 0; i < 8; ++i, bits >>= 8) ln.buff[ln.n++] = bits & 0xff;
+   ln.last = true;
+}
+
+void filei::hashn(const std::vector<std::string>& paths, 
+   bool ic, bool iw, size_t m, size_t bs,
+   std::vector<filei>& fis, std::vector<const char*>& errs) {
+
+   errs.assign(paths.size(),(const char*)0);
+   if (paths.size() < 2 || iw || _sparse || _tree) {
+      for(size_t i = 0; i < paths.size(); ++i) {
+         if (i + 1 < paths.size()) prefetch(paths[i + 1]);
+         try {
+            fis.push_back(filei(paths[i],ic,iw,m,bs));
+         } catch(const char* e) {
+            errs[i] = e;
+         }
+      }
+      return;
+   }
+
+   __UAPROBE1(hashn__start,paths.size());
+
+   fmd5 x;
+   int nl = std::min((size_t)x.lanes(),paths.size());
+   size_t bn = (std::max(bs,(size_t)64) + 63) & ~(size_t)63;
+   std::vector<__mlane> lanes(nl);
+   std::vector<unsigned char*> digests(paths.size(),(unsigned char*)0);
+   std::vector<unsigned char> md5s(16 * paths.size());
+   const unsigned char* blocks[16];
+
+   size_t next = 0;
+   for(int l = 0; l < nl; ++l) {
+      lanes[l].buff = static_cast<unsigned char*>(::malloc(bn + 128));
+      if (!lanes[l].buff) {
+         for(int k = 0; k < l; ++k) ::free(lanes[k].buff);
+         for(size_t i = 0; i < paths.size(); ++i) 
+            errs[i] = "Could not allocate memory";
+         return;
+      }
+      __mstart(lanes[l],x,l,paths,next,m,errs);
+   }
+
+   for(;;) {
+      int busy = 0;
+      for(int l = 0; l < nl; ++l) {
+         __mlane& ln = lanes[l];
+         while(ln.job >= 0 && ln.pos == ln.n) {
+            if (ln.last) { // done
+               x.get(l,&md5s[16 * ln.job]);
+               digests[ln.job] = &md5s[16 * ln.job];
+               __UAPROBE2(digest,paths[ln.job].c_str(),digests[ln.job]);
+               if (fprobe::_on) fprobe::add(fprobe::HASH,
+                  fprobe::now() - ln.t,paths[ln.job].c_str());
+            } else try {
+               __mfill(ln,ic,m,bn);
+               continue;
+            } catch(const char* e) {
+               errs[ln.job] = e;
+            }
+            delete ln.f;
+            __mstart(ln,x,l,paths,next,m,errs);
+         }
+         blocks[l] = ln.job < 0 ? 0 : ln.buff + ln.pos;
+         if (ln.job >= 0) ++busy, ln.pos += 64;
+      }
+      if (!busy) break;
+      for(int l = nl; l < x.lanes(); ++l) blocks[l] = 0;
+      x.compress(blocks);
+   }
+
+   for(int l = 0; l < nl; ++l) ::free(lanes[l].buff);
+   for(size_t i = 0; i < paths.size(); ++i) 
+      if (digests[i]) fis.push_back(filei(paths[i],digests[i]));
+
+   __UAPROBE1(hashn__done,paths.size());
+}
+
 bool filei::eq(
    const std::string& p1, const std::string& p2,
    bool ic, bool iw, size_t m, size_t bn) throw(const char*) {
@@ -271,8 +871,11 @@ bool filei::eq(
    char* buffer = 0;
    bool res = false;
 
-   std::ifstream is1(p1.c_str());
-   std::ifstream is2(p2.c_str());
+   __UAPROBE2(eq__start,p1.c_str(),p2.c_str());
+
+   prefetch(p2); // read side by side with p1
+   ffile is1(p1,m);
+   ffile is2(p2,m);
 
    if (!is1.good() || !is2.good()) { 
       error = "Could not open file";
@@ -294,7 +897,9 @@ bool filei::eq(
 
    try {
       size_t h = bn >> 1;
-      res = !iw && !ic ? __bytesame(is1,is2,buffer,buffer + h,h,bn-h,m) :
+      if (_sparse && !iw && !ic) 
+         res = __sparsesame(is1,is2,buffer,buffer + h,h,bn-h,m);
+      else res = !iw && !ic ? __bytesame(is1,is2,buffer,buffer + h,h,bn-h,m) :
          __same(is1,is2,buffer,buffer + h,h,bn-h,m,ic,iw);
    } catch(const char* e) {
       error = e;
@@ -305,11 +910,11 @@ bool filei::eq(
 FINALLY:
 
    // clean-up
-   is1.close(), is2.close();
    if (_relbuff) (*_relbuff)(buffer);
 
    if (error) throw error;
 
+   __UAPROBE3(eq__done,p1.c_str(),p2.c_str(),res);
    return res;
 }
 
@@ -52,6 +52,32 @@
 #define __UABUFFSIZE 32768
 #endif
 
+// window of the page cache neutral readers: the size of the aligned
+// O_DIRECT buffer and the granularity of dropping pages behind the reader
+//
+#if !defined(__UAIOWINDOW)
+#define __UAIOWINDOW 1048576
+#endif
+
+// alignment of O_DIRECT buffers
+//
+#if !defined(__UAIOALIGN)
+#define __UAIOALIGN 4096
+#endif
+
+// chunk of the tree hash: files larger than this are hashed
+// chunk by chunk, concurrently (see filei::_tree)
+//
+#if !defined(__UATREECHUNK)
+#define __UATREECHUNK 67108864
+#endif
+
+// default number of threads of the tree hash
+//
+#if !defined(__UATREEJOBS)
+#define __UATREEJOBS 4
+#endif
+
 #include <string>
 
 #if defined(__UA_USEHASH)
@@ -67,6 +93,10 @@
 #include <iostream>
 #include <iomanip>
 
+#include <fprobe.h>
+
+class finput;
+
 /** File info.
  *
  * Contains the path name and the corresponding md5 hash. 
@@ -86,6 +116,10 @@
  * If _buffc is 0, then it assumes that all requested memory is returned.
  * The code checks for _gbuff returning 0 (and catches exceptions) so it is
  * compatible with malloc and easy to wrap into an allocator as well.
+ *
+ * Files are read according to filei::_iomode. The default goes through
+ * the page cache; the other two modes keep a scan from evicting the
+ * working set of other processes on the machine.
  */
 class filei {
 
@@ -99,7 +133,19 @@ class filei {
       size_t _h; // hash of hash :)
 
       // calculate hash
-      void calc(bool ic, bool iw, size_t bs, size_t m) throw(const char*); 
+      void calc(finput& is, bool ic, bool iw, size_t bs, size_t m) 
+      throw(const char*); 
+
+      // calculate the sparse hash (see _sparse)
+      void calcs(finput& is, bool ic, size_t bs, size_t m) 
+      throw(const char*); 
+
+      // calculate the tree hash (see _tree), false without opening the
+      // file if it is small
+      bool calct(bool ic) throw(const char*);
+
+      // calculate the hash of hash
+      void hash();
 
       // return buffer 
       static void* gbuff(size_t) { return _buffer; }
@@ -109,6 +155,14 @@ class filei {
 
    public:
 
+      /** How files are read.
+       */
+      enum iomode_t {
+         IO_BUFFERED = 0, // plain reads through the page cache
+         IO_NOCACHE,      // sequential fadvise, drop pages behind the reader
+         IO_DIRECT        // O_DIRECT into aligned buffers
+      };
+
       /** Constructor.
        *
        * The constructor will open the file and calculate the hash.
@@ -124,6 +178,34 @@ class filei {
          size_t m = 0ul, size_t bs=1024ul)
       throw(const char*);
 
+      /** Constructor from an input.
+       *
+       * The constructor will read the input and calculate the hash.
+       * It can be used for things that are not files in the file system
+       * (eg. members of archives, see finput.h).
+       *
+       * @param path name of the input
+       * @param is the input
+       * @param ic ignore case
+       * @param iw ignore white space (in essence, remove it)
+       * @param m consider at most these many bytes for the hash (0: ALL)
+       * @param bs buffer size of internal work buffer (default 1024)
+       * @throws an error message if construction failed
+       */
+      filei(const std::string& path, finput& is, bool ic, bool iw,
+         size_t m = 0ul, size_t bs=1024ul)
+      throw(const char*);
+
+      /** Constructor from a known hash.
+       *
+       * The file is not read, the md5 hash is taken as it is
+       * (eg. it was calculated earlier or by some other process).
+       *
+       * @param path file name
+       * @param md5 the 16 md5 hash characters
+       */
+      filei(const std::string& path, const unsigned char* md5);
+
       /** Get an md5 hash char.
        * @param i index
        * @return md5 hash char at index
@@ -155,6 +237,58 @@ class filei {
         */
       static off_t fsize(const std::string& path) throw(const char*);
 
+      /** Ask the kernel to start reading a file.
+        *
+        * Issues readahead(2) on the beginning of the file, so that the
+        * read of the next queued file overlaps with the processing of 
+        * the current one. It only does something when _iomode is 
+        * IO_NOCACHE (O_DIRECT reads bypass the page cache and the
+        * default mode is left to the kernel's own heuristics).
+        * filei::hashn does it for the files of its list and filei::eq
+        * for its second file. Errors are ignored.
+        *
+        * @param path file name
+        * @param n number of bytes to read ahead (0: one I/O window)
+        */
+      static void prefetch(const std::string& path, size_t n = 0ul);
+
+      /** Hash several files at once.
+        *
+        * The files are hashed side by side in the lanes of the multi-buffer
+        * MD5 (see fmd5.h), which is several times faster than one file 
+        * after the other when they are in the page cache. White space 
+        * removal, sparse and tree hashes are done one file at a time.
+        * The hashes are the same either way.
+        *
+        * @param paths files
+        * @param ic ignore case
+        * @param iw ignore white space
+        * @param m consider at most these many bytes for the hash (0: ALL)
+        * @param bs size of the buffer of each lane (default 1024)
+        * @param fis file infos of the files hashed (returned, in order)
+        * @param errs error of each file, 0 if it was hashed (returned)
+        */
+      static void hashn(const std::vector<std::string>& paths, 
+         bool ic, bool iw, size_t m, size_t bs,
+         std::vector<filei>& fis, std::vector<const char*>& errs);
+
+      /** Hash a file in all four ways in a single read.
+        *
+        * Each buffer read is hashed as it is, in lower case, without
+        * white spaces and both, so the four hashes are those of
+        * filei(path,false,false,m,bs), filei(path,true,false,m,bs),
+        * filei(path,false,true,m,bs) and filei(path,true,true,m,bs).
+        * Sparse and tree hashes are not made.
+        *
+        * @param path file name
+        * @param m consider at most these many bytes for each hash (0: ALL)
+        * @param bs internal buffer size (default 1024)
+        * @param fis the four file infos, in the order above (returned)
+        * @throws a description if the file could not be hashed
+        */
+      static void variants(const std::string& path, size_t m, size_t bs,
+         std::vector<filei>& fis) throw(const char*);
+
       /** Determine whether the two files are identical.
         * @param p1 path of one file
         * @param p2 path of the other
@@ -230,6 +364,50 @@ class filei {
         * returned by (*_gbuff)(size_t).
         */
       static void (*_relbuff)(void*);
+
+      /** How files are read (default IO_BUFFERED).
+        *
+        * IO_NOCACHE advises the kernel of sequential access and drops
+        * the pages behind the reader every __UAIOWINDOW bytes.
+        * IO_DIRECT opens with O_DIRECT and reads __UAIOWINDOW aligned
+        * windows (smaller when only a prefix is hashed); when the file
+        * system refuses O_DIRECT, it falls back to IO_NOCACHE.
+        */
+      static iomode_t _iomode;
+
+      /** Sparse file aware hashing and comparison (default false).
+        *
+        * Runs of aligned, all zero 4K blocks are not hashed as bytes,
+        * they are recorded by their position and length. The holes of
+        * sparse files are such runs and they are never read (with 
+        * SEEK_DATA/SEEK_HOLE). Since zero blocks which are stored are
+        * treated the same way, a sparse file and its non-sparse copy 
+        * have the same hash, but the hash is not the md5 of the file.
+        * eq() walks the extent maps of the files and does not read the 
+        * holes either (this does not change its result).
+        * Not used when white space is ignored.
+        */
+      static bool _sparse;
+
+      /** Threads of the tree hash (default 0: no tree hash).
+        *
+        * When set, files larger than __UATREECHUNK are cut into chunks 
+        * of that size, which are read (pread) and hashed by this many 
+        * threads at once, and the hash is the md5 of the md5 of the 
+        * chunks and the length of the file (a Merkle tree of two levels).
+        * The hash is not the md5 of the file. Only used by the
+        * constructor from a path, when the whole file is hashed and 
+        * neither white space is ignored nor _sparse is set.
+        */
+      static int _tree;
+
+      /** Function called after each read from a file (default 0: none).
+        *
+        * The argument is the number of bytes read. It may block to slow
+        * down the reads (see fthrottle.h). It is called concurrently by
+        * the threads of the tree hash.
+        */
+      static void (*_rdhook)(size_t);
 };
 
 
@@ -282,16 +460,6 @@ class fset {
 
       typedef typename M::const_iterator it_t; // subset iterator
 
-      /** Add a file info.
-        * @param fi file info
-        */
-      void add(const filei& fi) {
-         typename S::const_iterator i = _files.find(fi);
-         if (i != _files.end()) _cmn[*i].push_back(fi.path());
-         else _files.insert(fi);
-      }
-
-
    public:
  
       /** Constructor.
@@ -314,6 +482,29 @@ class fset {
          add(filei(path,_ic,_iw,_max,_bs));
       }
 
+      /** Add files, hashed at once (see filei::hashn).
+        * @param paths files
+        * @param errs error of each file, 0 if it was added (returned)
+        */
+      void add(const std::vector<std::string>& paths, 
+         std::vector<const char*>& errs) {
+         std::vector<filei> fis;
+         filei::hashn(paths,_ic,_iw,_max,_bs,fis,errs);
+         for(int i = 0; i < (int)fis.size(); ++i) add(fis[i]);
+      }
+
+      /** Add a file info.
+        *
+        * The hash must have been calculated with the same settings
+        * (ignore case, white space and max chars) as this set's.
+        * @param fi file info
+        */
+      void add(const filei& fi) {
+         typename S::const_iterator i = _files.find(fi);
+         if (i != _files.end()) _cmn[*i].push_back(fi.path());
+         else _files.insert(fi);
+      }
+
       /** Print the sets of identical files.
         *
         * Each set of identical files are printed on a single line.
@@ -369,21 +560,32 @@ class fset {
        */
       static void common(M& res, const M& cmn, 
          bool ic, bool iw, size_t m=0, size_t bs=1204) {
+         __UAPROBE1(common__start,cmn.size());
          for(it_t it=cmn.begin(); it != cmn.end(); ++it) {
             fset files(ic,iw,m,bs);
-            files.add(it->first.path());
-            for(int i=0; i<(int)it->second.size();++i) files.add(it->second[i]);
+            std::vector<std::string> paths(1,it->first.path());
+            paths.insert(paths.end(),it->second.begin(),it->second.end());
+            std::vector<const char*> errs;
+            files.add(paths,errs);
+            for(int i = 0; i < (int)errs.size(); ++i) 
+               if (errs[i]) throw errs[i];
 
             const M& locmn = files.common();
             for(it_t lit = locmn.begin(); lit!=locmn.end(); ++lit) {
                res[lit->first] = lit->second;
             }
          }
+         __UAPROBE1(common__done,cmn.size());
       }
 };
 
+/** Vector of file infos. */
+typedef std::vector<filei> fivec_t;
+
 /** Choose preferred types for file set and result set.
  * fsetc_t: preferred type for the map from file size to file names
+ * fsetk_t: preferred type for the map from file size to file infos
+ *          whose hash is already known (eg. archive members)
  * res_t:   preferred type for the map of identical subsets 
  * fset_t:  preferred type for the fset object
  *
@@ -392,8 +594,10 @@ class fset {
 typedef fset<hset_t,hmap_t> fset_t;
 typedef hmap_t res_t;
 typedef __gnu_cxx::hash_map<size_t,fvec_t> fsetc_t;
+typedef __gnu_cxx::hash_map<size_t,fivec_t> fsetk_t;
 #else
 typedef std::map<size_t,fvec_t> fsetc_t;
+typedef std::map<size_t,fivec_t> fsetk_t;
 typedef map_t res_t;
 typedef fset<set_t,map_t> fset_t;
 #endif
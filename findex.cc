@@ -0,0 +1,287 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MEMORY MAPPED DIGEST INDEX - IMPLEMENTATION
+//
+
+#include <findex.h>
+
+#include <algorithm>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+}
+
+static const char __magic[8] = { 'u','a','-','i','n','d','e','x' };
+
+// directory slot of a key
+static inline uint64_t __slot(uint64_t k, uint32_t bits) {
+   return bits ? k >> (64 - bits) : 0;
+}
+
+uint64_t findex::key(uint64_t size, const unsigned char* pmd5) {
+   uint64_t k;
+   ::memcpy(&k,pmd5,8);
+   k ^= size * 0x9e3779b97f4a7c15ULL;
+   // finalizer of murmur3, the size has to reach the top bits
+   k ^= k >> 33;
+   k *= 0xff51afd7ed558ccdULL;
+   k ^= k >> 33;
+   k *= 0xc4ceb3f97a4ed5e3ULL;
+   k ^= k >> 33;
+   return k;
+}
+
+uint64_t findex::key(uint64_t size) {
+   static const unsigned char none[16] = { 
+      0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff,
+      0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff };
+   return key(size,none);
+}
+
+uint64_t findex::bits(uint64_t k, uint32_t lines, uint64_t* mask) {
+   ::memset(mask,0,64);
+   // 7 bit positions out of 512, from 9 bit chunks of another mix
+   uint64_t g = k * 0x9e3779b97f4a7c15ULL;
+   for(int i = 0; i < 7; ++i, g >>= 9) mask[(g >> 6) & 7] |= 1ULL << (g & 63);
+   return lines ? k >> (64 - lines) : 0;
+}
+
+bool findex::bloom(uint64_t k) const {
+   if (!_filter) return true;
+   uint64_t mask[8];
+   const uint64_t* l = _filter + 8 * bits(k,_h->lines,mask);
+   for(int i = 0; i < 8; ++i) if ((l[i] & mask[i]) != mask[i]) return false;
+   return true;
+}
+
+bool findex::less(const entry& e1, const entry& e2) {
+   uint64_t k1 = key(e1.size,e1.pmd5), k2 = key(e2.size,e2.pmd5);
+   if (k1 != k2) return k1 < k2;
+   if (e1.size != e2.size) return e1.size < e2.size;
+   int c = ::memcmp(e1.pmd5,e2.pmd5,16);
+   if (c) return c < 0;
+   c = ::memcmp(e1.md5,e2.md5,16);
+   if (c) return c < 0;
+   return e1.path < e2.path;
+}
+
+findex::findex(const std::string& path) throw(const char*): 
+   _fd(-1), _map(0), _len(0), _filter(0) {
+
+   const char* error = 0;
+   struct stat st;
+
+   if ((_fd = ::open(path.c_str(),O_RDONLY)) < 0) throw "Could not open index";
+   if (::fstat(_fd,&st) || st.st_size < 64) { // the header of version 1
+      error = "Not an index";
+      goto FINALLY;
+   }
+
+   _len = st.st_size;
+   _map = static_cast<const char*>(::mmap(0,_len,PROT_READ,MAP_SHARED,_fd,0));
+   if (_map == MAP_FAILED) {
+      _map = 0;
+      error = "Could not map index";
+      goto FINALLY;
+   }
+   // lookups jump around, don't read ahead
+   ::madvise(const_cast<char*>(_map),_len,MADV_RANDOM);
+
+   _h = reinterpret_cast<const head*>(_map);
+   if (::memcmp(_h->magic,__magic,8)) { error = "Not an index"; goto FINALLY; }
+   if (_h->version != 1 && _h->version != 2) { 
+      error = "Unknown index version"; 
+      goto FINALLY; 
+   }
+   if (_h->version > 1 && (_len < sizeof(head) || _h->lines > 32 || 
+      _h->dir < sizeof(head) || _h->filter % 64 ||
+      _h->filter < _h->dir + ((1ULL << _h->bits) + 1) * 8 ||
+      _h->filter + (64ULL << _h->lines) > _h->recs)) {
+      error = "Corrupt index";
+      goto FINALLY;
+   }
+   if (_h->bits > 32 || _h->dir < 64 || 
+      _h->dir + ((1ULL << _h->bits) + 1) * 8 > _h->recs ||
+      _h->recs + _h->n * sizeof(rec) > _h->paths || _h->paths > _len ||
+      (_h->n && _map[_len - 1])) {
+      error = "Corrupt index";
+      goto FINALLY;
+   }
+
+   _dir = reinterpret_cast<const uint64_t*>(_map + _h->dir);
+   _recs = reinterpret_cast<const rec*>(_map + _h->recs);
+   _paths = _map + _h->paths;
+   if (_h->version > 1) 
+      _filter = reinterpret_cast<const uint64_t*>(_map + _h->filter);
+   _opts = std::string(_h->opts,::strnlen(_h->opts,sizeof(_h->opts)));
+
+FINALLY:
+   if (error) {
+      if (_map) ::munmap(const_cast<char*>(_map),_len);
+      ::close(_fd);
+      throw error;
+   }
+}
+
+findex::~findex() {
+   ::munmap(const_cast<char*>(_map),_len);
+   ::close(_fd);
+}
+
+bool findex::has(off_t size, const unsigned char* pmd5) const {
+   fvec_t none;
+   return find(size,pmd5,0,none);
+}
+
+bool findex::find(off_t size, const unsigned char* pmd5, 
+   const unsigned char* md5, fvec_t& paths) const {
+
+   uint64_t k = key(size,pmd5);
+   if (!bloom(k)) return false;
+   uint64_t j = __slot(k,_h->bits);
+   uint64_t e = std::min(_dir[j + 1],(uint64_t)_h->n);
+   uint64_t pl = _len - _h->paths; // length of the path section
+
+   for(uint64_t i = _dir[j]; i < e; ++i) {
+      const rec& r = _recs[i];
+      if ((uint64_t)size != r.size || ::memcmp(pmd5,r.pmd5,16)) continue;
+      if (!md5) return true;
+      if (::memcmp(md5,r.md5,16)) continue;
+
+      if (r.paths >= pl) return false;
+      for(const char* p = _paths + r.paths; *p; p += ::strlen(p) + 1) 
+         paths.push_back(p);
+      return true;
+   }
+
+   return false;
+}
+
+void findex::write(const std::string& path, std::vector<entry>& es,
+   size_t prefix, const std::string& opts) throw(const char*) {
+
+   std::sort(es.begin(),es.end(),less);
+
+   // one record for each content, followed by its paths
+   std::vector<rec> recs;
+   std::string paths;
+   for(int i = 0; i < (int)es.size(); ++i) {
+      const entry& e = es[i];
+      if (!i || e.size != es[i - 1].size || 
+         ::memcmp(e.pmd5,es[i - 1].pmd5,16) || ::memcmp(e.md5,es[i - 1].md5,16)) {
+         if (i) paths += '\0';
+         rec r;
+         r.size = e.size;
+         r.paths = paths.size();
+         ::memcpy(r.pmd5,e.pmd5,16);
+         ::memcpy(r.md5,e.md5,16);
+         recs.push_back(r);
+      }
+      paths += e.path;
+      paths += '\0';
+   }
+   if (recs.size()) paths += '\0';
+
+   head h;
+   ::memset(&h,0,sizeof(h));
+   ::memcpy(h.magic,__magic,8);
+   h.version = 2;
+   h.bits = 0;
+   while(h.bits < 32 && (1ULL << h.bits) * __UAIDXBUCKET < recs.size()) ++h.bits;
+   h.n = recs.size();
+   h.prefix = prefix;
+   ::memcpy(h.opts,opts.data(),std::min(opts.size(),sizeof(h.opts)));
+
+   // first record of each slot
+   std::vector<uint64_t> dir((1ULL << h.bits) + 1);
+   for(uint64_t j = 0, i = 0; j < dir.size(); ++j) {
+      while(i < recs.size() && __slot(key(recs[i].size,recs[i].pmd5),h.bits) < j) 
+         ++i;
+      dir[j] = i;
+   }
+   dir.back() = recs.size();
+
+   // the filter of the keys and the sizes, a power of 2 of cache lines
+   h.lines = 0;
+   while(h.lines < 32 && (512ULL << h.lines) < 2 * recs.size() * __UAIDXBLOOM)
+      ++h.lines;
+   std::vector<uint64_t> filter(8ULL << h.lines);
+   for(int i = 0; i < (int)recs.size(); ++i) {
+      uint64_t ks[2] = { key(recs[i].size,recs[i].pmd5), key(recs[i].size) };
+      for(int j = 0; j < 2; ++j) {
+         uint64_t mask[8];
+         uint64_t* l = &filter[8 * bits(ks[j],h.lines,mask)];
+         for(int w = 0; w < 8; ++w) l[w] |= mask[w];
+      }
+   }
+
+   // sections start on cache lines
+   h.dir = sizeof(h);
+   h.filter = (h.dir + dir.size() * 8 + 63) & ~63ULL;
+   h.recs = h.filter + filter.size() * 8;
+   h.paths = h.recs + recs.size() * sizeof(rec);
+
+   std::string tmp = path + ".XXXXXX";
+   std::vector<char> tb(tmp.begin(),tmp.end());
+   tb.push_back('\0');
+   int fd = ::mkstemp(&tb[0]);
+   if (fd < 0) throw "Could not create index";
+   ::fchmod(fd,0644);
+
+   FILE* f = ::fdopen(fd,"w");
+   if (!f) {
+      ::close(fd);
+      ::unlink(&tb[0]);
+      throw "Could not create index";
+   }
+
+   static const char pad[64] = { 0 };
+   bool ok = ::fwrite(&h,sizeof(h),1,f) == 1 &&
+      ::fwrite(&dir[0],8,dir.size(),f) == dir.size() &&
+      ::fwrite(pad,1,h.filter - h.dir - dir.size() * 8,f) == 
+         h.filter - h.dir - dir.size() * 8 &&
+      ::fwrite(&filter[0],8,filter.size(),f) == filter.size() &&
+      (recs.empty() || ::fwrite(&recs[0],sizeof(rec),recs.size(),f) == recs.size()) &&
+      ::fwrite(paths.data(),1,paths.size(),f) == paths.size();
+   ok = !::fclose(f) && ok;
+
+   if (!ok || ::rename(&tb[0],path.c_str())) {
+      ::unlink(&tb[0]);
+      throw "Could not write index";
+   }
+}
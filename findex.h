@@ -0,0 +1,231 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MEMORY MAPPED DIGEST INDEX - HEADER
+//
+
+#if !defined(_FINDEX_H_)
+#define _FINDEX_H_
+
+// length of the prefix digested for the first lookup
+//
+#if !defined(__UAIDXPREFIX)
+#define __UAIDXPREFIX 4096
+#endif
+
+// average number of records in a bucket of the directory
+//
+#if !defined(__UAIDXBUCKET)
+#define __UAIDXBUCKET 16
+#endif
+
+// bits of the Bloom filter for each key (at least)
+//
+#if !defined(__UAIDXBLOOM)
+#define __UAIDXBLOOM 10
+#endif
+
+#include <filei.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+#include <stdint.h>
+}
+
+/** Memory mapped digest index.
+ *
+ * The index answers whether a file with a given content exists in a
+ * set of files, without reading any of them. It is a file made of
+ * <pre>
+ *    header     80 bytes (64 in version 1)
+ *    directory  2^bits + 1 record numbers
+ *    filter     2^lines cache lines (not in version 1)
+ *    records    (size, prefix md5, md5, paths) sorted by the key below
+ *    paths      for each record, its path names (NUL terminated),
+ *               closed by an empty name
+ * </pre>
+ * in host byte order. There is one record for each distinct content;
+ * the prefix md5 is the hash of the first prefix() bytes (of the whole 
+ * file if shorter). Records are sorted by a 64 bit mix of the size and
+ * the prefix md5, and the directory (a B-tree of a single level) maps
+ * the top bits of the mix to the first record of the bucket. Since the
+ * mix is uniform, buckets have about __UAIDXBUCKET records and a lookup
+ * touches a directory page and a record page. The prefix lookup tells
+ * whether the full hash of a file is worth calculating at all.
+ *
+ * The filter is a blocked Bloom filter of the keys and of the sizes
+ * alone: 7 bits of a cache line chosen by the key are set for each, so a
+ * lookup of a key (or a size) the index does not have touches a single
+ * cache line, and mostly not the directory and the records.
+ *
+ * <pre>
+ *    findex idx("files.idx");
+ *    if (idx.may(size) && idx.has(size,pmd5)) idx.find(size,pmd5,md5,paths);
+ * </pre>
+ */
+class findex {
+
+   public:
+
+      /** A file to be indexed.
+       */
+      struct entry {
+         off_t size;             // size in bytes
+         unsigned char pmd5[16]; // md5 of the prefix
+         unsigned char md5[16];  // md5 of the file
+         std::string path;       // path name
+      };
+
+   private:
+
+      // on-disk record
+      struct rec {
+         uint64_t size;          
+         uint64_t paths;         // offset in the path section
+         unsigned char pmd5[16]; 
+         unsigned char md5[16];  
+      };
+
+      // on-disk header
+      struct head {
+         char magic[8];          // "ua-index"
+         uint32_t version;       // 1
+         uint32_t bits;          // bits of the directory
+         uint64_t n;             // number of records
+         uint64_t prefix;        // prefix length
+         uint64_t dir;           // offset of the directory
+         uint64_t recs;          // offset of the records
+         uint64_t paths;         // offset of the path section
+         char opts[8];           // options affecting the hash
+         uint64_t filter;        // offset of the filter (version 2)
+         uint32_t lines;         // log2 of its cache lines
+         uint32_t pad;
+      };
+
+      int _fd;
+      const char* _map; // the mapped index
+      size_t _len;      // its length
+
+      const head* _h;
+      const uint64_t* _dir;
+      const rec* _recs;
+      const char* _paths;
+      const uint64_t* _filter; // 0: none (version 1)
+      std::string _opts;
+
+      // sort key of a record
+      static uint64_t key(uint64_t size, const unsigned char* pmd5);
+
+      // key of a size in the filter
+      static uint64_t key(uint64_t size);
+
+      // bits of a key in the filter (the line, and the mask of its words)
+      static uint64_t bits(uint64_t k, uint32_t lines, uint64_t* mask);
+
+      // is a key in the filter?
+      bool bloom(uint64_t k) const;
+
+      // order of the records
+      static bool less(const entry& e1, const entry& e2);
+
+      // no copies, the map is owned
+      findex(const findex&);
+      findex& operator=(const findex&);
+
+   public:
+
+      /** Open and map an index.
+       * @param path the index file
+       * @throws a description if it is not an index
+       */
+      findex(const std::string& path) throw(const char*);
+
+      /** Destructor, unmaps the index.
+       */
+      ~findex();
+
+      /** Length of the prefixes hashed.
+       * @return the prefix length in bytes
+       */
+      size_t prefix() const { return _h->prefix; }
+
+      /** Options the hashes were calculated with.
+       * @return the options ("i": ignore case, "s": sparse)
+       */
+      const std::string& opts() const { return _opts; }
+
+      /** Number of distinct contents indexed.
+       * @return number of records
+       */
+      size_t size() const { return _h->n; }
+
+      /** May there be a file of this size?
+       * Only the filter is looked up (no false negatives).
+       * @param size file size
+       * @return false if there is none for sure
+       */
+      bool may(off_t size) const { return bloom(key(size)); }
+
+      /** Is there a file with this size and prefix?
+       * @param size file size
+       * @param pmd5 md5 of the prefix
+       * @return true if there is at least one
+       */
+      bool has(off_t size, const unsigned char* pmd5) const;
+
+      /** Files with this content.
+       * @param size file size
+       * @param pmd5 md5 of the prefix
+       * @param md5 md5 of the file
+       * @param paths the path names (appended)
+       * @return true if there is at least one
+       */
+      bool find(off_t size, const unsigned char* pmd5, 
+         const unsigned char* md5, fvec_t& paths) const;
+
+      /** Write an index.
+       *
+       * The file is written next to path and renamed, so readers see 
+       * either the old or the new index.
+       * @param path the index file
+       * @param es the files (sorted in place)
+       * @param prefix length of the prefixes hashed
+       * @param opts options the hashes were calculated with
+       * @throws a description if the index could not be written
+       */
+      static void write(const std::string& path, std::vector<entry>& es,
+         size_t prefix, const std::string& opts) throw(const char*);
+};
+
+#endif
@@ -0,0 +1,265 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// SEQUENTIAL INPUTS - IMPLEMENTATION
+//
+
+#include <finput.h>
+#include <fprobe.h>
+
+#include <algorithm>
+
+extern "C" {
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+}
+
+void finput::skip(off_t n) throw(const char*) {
+   char buff[4096];
+   while(n > 0) {
+      size_t k = read(buff,std::min((off_t)sizeof(buff),n));
+      if (!k) break;
+      n -= k;
+   }
+}
+
+ffile::ffile(const std::string& path, size_t hint):
+   _fd(-1), _mode(filei::_iomode), _win(0), _wc(0), _wn(0), _wp(0),
+   _pos(0), _drop(0), _end(false), _eof(false), 
+   _size(-1), _xhole(false), _xend(0) {
+
+   __UAPROBE1(open__start,path.c_str());
+   double t = fprobe::_on ? fprobe::now() : 0;
+
+   if (_mode == filei::IO_DIRECT) {
+      _wc = __UAIOWINDOW;
+      if (hint && hint < _wc) 
+         _wc = (hint + __UAIOALIGN - 1) / __UAIOALIGN * __UAIOALIGN;
+
+      void* p = 0;
+      if (!::posix_memalign(&p,__UAIOALIGN,_wc)) {
+         _win = static_cast<char*>(p);
+         _fd = ::open(path.c_str(),O_RDONLY | O_DIRECT);
+      }
+      if (_fd < 0) _mode = filei::IO_NOCACHE; // not supported here
+   }
+
+   if (_fd < 0) _fd = ::open(path.c_str(),O_RDONLY);
+
+   if (fprobe::_on) fprobe::add(fprobe::OPEN,fprobe::now() - t);
+   __UAPROBE2(open__done,path.c_str(),_fd);
+
+   if (_fd >= 0 && _mode == filei::IO_NOCACHE) 
+      ::posix_fadvise(_fd,0,0,POSIX_FADV_SEQUENTIAL);
+}
+
+ffile::~ffile() {
+   if (_fd >= 0) {
+      if (_mode == filei::IO_NOCACHE) drop(true);
+      ::close(_fd);
+   }
+   ::free(_win);
+}
+
+void ffile::drop(bool all) {
+   if (all) ::posix_fadvise(_fd,0,0,POSIX_FADV_DONTNEED);
+   else {
+      ::posix_fadvise(_fd,_drop,_pos - _drop,POSIX_FADV_DONTNEED);
+      _drop = _pos;
+   }
+}
+
+size_t ffile::fill(char* p, size_t n) throw(const char*) {
+   size_t r = 0;
+
+   while(r < n && !_end) {
+      double t = fprobe::_on ? fprobe::now() : 0;
+      ssize_t k = ::read(_fd,p + r,n - r);
+      if (fprobe::_on) fprobe::add(fprobe::READ,fprobe::now() - t);
+      __UAPROBE2(read__done,_fd,k);
+      if (k < 0) {
+         if (errno == EINTR) continue;
+         if (errno == EINVAL && _mode == filei::IO_DIRECT) { 
+            // alignment refused after all, continue through the cache
+            ::fcntl(_fd,F_SETFL,::fcntl(_fd,F_GETFL) & ~O_DIRECT);
+            ::posix_fadvise(_fd,0,0,POSIX_FADV_SEQUENTIAL);
+            _mode = filei::IO_NOCACHE;
+            continue;
+         }
+         throw "Could not read file";
+      }
+      if (!k) _end = true;
+      else if (filei::_rdhook) (*filei::_rdhook)(k);
+      r += k;
+      // a short O_DIRECT read is the end of the file
+      if (_mode == filei::IO_DIRECT && r < n) _end = true;
+   }
+
+   return r;
+}
+
+size_t ffile::read(char* buff, size_t n) throw(const char*) {
+   size_t r = 0;
+
+   if (!_win) r = fill(buff,n);
+   else while(r < n) {
+      if (_wp == _wn) {
+         if (_end) break;
+         _wn = fill(_win,_wc), _wp = 0;
+         if (!_wn) break;
+      }
+      size_t k = std::min(n - r,_wn - _wp);
+      ::memcpy(buff + r,_win + _wp,k);
+      r += k, _wp += k;
+   }
+
+   _pos += r;
+   _eof = r < n;
+
+   if (_mode == filei::IO_NOCACHE && _pos - _drop >= __UAIOWINDOW) drop(false);
+
+   return r;
+}
+
+void ffile::skip(off_t n) throw(const char*) {
+   // O_DIRECT reads have to stay aligned
+   if (_win) { finput::skip(n); return; }
+
+   if (::lseek(_fd,n,SEEK_CUR) == (off_t)-1) throw "Could not seek file";
+   _pos += n;
+}
+
+off_t ffile::size() {
+   if (_size < 0) {
+      struct stat fsi;
+      _size = ::fstat(_fd,&fsi) ? 0 : fsi.st_size;
+   }
+   return _size;
+}
+
+off_t ffile::extent(bool& hole) {
+   hole = false;
+   if (_win || _pos >= size()) return size();
+
+   if (_pos >= _xend) {
+      off_t d = ::lseek(_fd,_pos,SEEK_DATA);
+      // ENXIO: a hole up to the end, otherwise not supported
+      if (d < 0) d = errno == ENXIO ? size() : _pos;
+
+      if (d > _pos) _xhole = true, _xend = d;
+      else {
+         off_t h = ::lseek(_fd,_pos,SEEK_HOLE);
+         _xhole = false, _xend = h > _pos ? h : size();
+      }
+      ::lseek(_fd,_pos,SEEK_SET);
+   }
+
+   hole = _xhole;
+   return _xend;
+}
+
+size_t fmem::read(char* buff, size_t n) throw(const char*) {
+   size_t k = std::min(n,(size_t)(_e - _p));
+   ::memcpy(buff,_p,k);
+   _p += k;
+   _eof = k < n;
+   return k;
+}
+
+void fmem::skip(off_t n) throw(const char*) {
+   _p += std::min(n,(off_t)(_e - _p));
+}
+
+size_t fistream::read(char* buff, size_t n) throw(const char*) {
+   _is.read(buff,n);
+   if (_is.bad()) throw "Could not read stream";
+   return _is.gcount();
+}
+
+size_t fsub::read(char* buff, size_t n) throw(const char*) {
+   size_t w = (size_t)std::min((off_t)n,_left);
+   size_t k = _in->read(buff,w);
+   if (k < w) throw "Unexpected end of input";
+   _left -= k;
+   _eof = k < n;
+   return k;
+}
+
+void fsub::skip(off_t n) throw(const char*) {
+   n = std::min(n,_left);
+   _in->skip(n);
+   _left -= n;
+}
+
+fslurp::~fslurp() {
+   if (_fd >= 0) ::close(_fd);
+}
+
+const char* fslurp::read(const std::string& path, char* b, size_t n) {
+   std::string::size_type e = path.rfind('/');
+   std::string dir = e == std::string::npos ? "." : path.substr(0,e ? e : 1);
+   if (dir != _dir) {
+      if (_fd >= 0) ::close(_fd);
+      _dir = dir;
+      _fd = ::open(dir.c_str(),O_RDONLY | O_DIRECTORY);
+   }
+   const char* name = path.c_str();
+   int dfd = AT_FDCWD;
+   if (_fd >= 0) dfd = _fd, name += e == std::string::npos ? 0 : e + 1;
+
+   __UAPROBE1(open__start,path.c_str());
+   double t = fprobe::_on ? fprobe::now() : 0;
+   int fd = ::openat(dfd,name,O_RDONLY | O_NOATIME);
+   if (fd < 0 && errno == EPERM) fd = ::openat(dfd,name,O_RDONLY);
+   if (fprobe::_on) fprobe::add(fprobe::OPEN,fprobe::now() - t);
+   __UAPROBE2(open__done,path.c_str(),fd);
+   if (fd < 0) return "Could not open file";
+
+   // one read of n + 1 bytes: n of them unless the file has changed
+   // (again only if interrupted or short)
+   size_t r = 0;
+   while(r < n) {
+      t = fprobe::_on ? fprobe::now() : 0;
+      ssize_t k = ::read(fd,b + r,n + 1 - r);
+      if (fprobe::_on) fprobe::add(fprobe::READ,fprobe::now() - t);
+      __UAPROBE2(read__done,fd,k);
+      if (k < 0 && errno == EINTR) continue;
+      if (k <= 0) break;
+      r += k;
+   }
+   ::close(fd);
+   if (filei::_rdhook) (*filei::_rdhook)(r);
+   return r == n ? 0 : "File changed size";
+}
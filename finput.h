@@ -0,0 +1,259 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// SEQUENTIAL INPUTS - HEADER
+//
+
+#if !defined(_FINPUT_H_)
+#define _FINPUT_H_
+
+#include <filei.h>
+
+#include <string>
+#include <istream>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+/** Sequential input.
+ *
+ * The source of the bytes filei hashes and compares. read() behaves
+ * like istream::read() followed by istream::gcount(), and eof() tells 
+ * whether the last read() came up short (the end of the input). Errors
+ * are thrown as descriptions.
+ */
+class finput {
+   public:
+
+      virtual ~finput() {}
+
+      /** Whether the input could be opened.
+        * @return true if the input can be read
+        */
+      virtual bool good() const = 0;
+
+      /** Read the next bytes.
+        * @param buff destination
+        * @param n number of bytes requested
+        * @return number of bytes read (less than n only at the end)
+        * @throws a description on read errors
+        */
+      virtual size_t read(char* buff, size_t n) throw(const char*) = 0;
+
+      /** Whether the last read came up short.
+        * @return true at the end of the input
+        */
+      virtual bool eof() const = 0;
+
+      /** Skip bytes.
+        * The default reads and discards them.
+        * @param n number of bytes to skip
+        * @throws a description on read errors
+        */
+      virtual void skip(off_t n) throw(const char*);
+};
+
+/** A file, read according to filei::_iomode.
+ */
+class ffile: public finput {
+   private:
+      int _fd;
+      filei::iomode_t _mode;
+      char* _win;  // aligned window (O_DIRECT only)
+      size_t _wc;  // window capacity
+      size_t _wn;  // bytes in window
+      size_t _wp;  // read position in window
+      off_t _pos;  // bytes delivered so far
+      off_t _drop; // the page cache is dropped below this offset
+      bool _end;   // the file is exhausted
+      bool _eof;   // last read was short
+      off_t _size; // file size (-1: not asked yet)
+      bool _xhole; // whether the last extent seen is a hole
+      off_t _xend; // end of the last extent seen
+
+      // read from the file, retry on interrupts and short reads
+      size_t fill(char* p, size_t n) throw(const char*);
+
+      // drop cached pages behind the reader
+      void drop(bool all);
+
+      // no copies
+      ffile(const ffile&);
+      ffile& operator=(const ffile&);
+
+   public:
+
+      /** Constructor.
+       * @param path file name
+       * @param hint expected number of bytes read (0: the whole file)
+       */
+      ffile(const std::string& path, size_t hint = 0ul);
+
+      /** Destructor, closes the file.
+       */
+      ~ffile();
+
+      bool good() const { return _fd >= 0; }
+
+      size_t read(char* buff, size_t n) throw(const char*);
+
+      bool eof() const { return _eof; }
+
+      void skip(off_t n) throw(const char*);
+
+      /** File size.
+        * @return the size of the file when it was first asked
+        */
+      off_t size();
+
+      /** The extent (data or hole) at the current position.
+        *
+        * Uses SEEK_DATA/SEEK_HOLE. When the file system cannot tell, 
+        * or the file is read with O_DIRECT, the whole file is data.
+        *
+        * @param hole whether the current position is in a hole (returned)
+        * @return the end of the extent (file offset)
+        */
+      off_t extent(bool& hole);
+};
+
+/** A memory range.
+ */
+class fmem: public finput {
+   private:
+      const char* _p; // next byte
+      const char* _e; // end of range
+      bool _eof;
+
+   public:
+
+      /** Constructor.
+       * @param p first byte (the range is not copied)
+       * @param n number of bytes
+       */
+      fmem(const char* p, size_t n): _p(p), _e(p + n), _eof(false) {}
+
+      bool good() const { return true; }
+
+      size_t read(char* buff, size_t n) throw(const char*);
+
+      bool eof() const { return _eof; }
+
+      void skip(off_t n) throw(const char*);
+};
+
+/** A standard input stream.
+ */
+class fistream: public finput {
+   private:
+      std::istream& _is;
+
+   public:
+
+      /** Constructor.
+       * @param is the stream (not owned)
+       */
+      fistream(std::istream& is): _is(is) {}
+
+      bool good() const { return !_is.bad(); }
+
+      size_t read(char* buff, size_t n) throw(const char*);
+
+      bool eof() const { return _is.eof(); }
+};
+
+/** At most a given number of bytes of another input.
+ *
+ * Eg. a member of an archive.
+ */
+class fsub: public finput {
+   private:
+      finput* _in; // the whole input
+      off_t _left; // bytes left
+      bool _eof;
+
+   public:
+
+      /** Constructor.
+       * @param in the whole input (not owned)
+       * @param n number of bytes
+       */
+      fsub(finput& in, off_t n): _in(&in), _left(n), _eof(false) {}
+
+      bool good() const { return _in->good(); }
+
+      size_t read(char* buff, size_t n) throw(const char*);
+
+      bool eof() const { return _eof; }
+
+      void skip(off_t n) throw(const char*);
+
+      /** Bytes not read yet.
+        * @return number of bytes left
+        */
+      off_t left() const { return _left; }
+};
+
+
+/** Whole small files.
+ *
+ * Each file is opened relative to its directory (openat(2), the
+ * directory of the previous file is kept open), without updating its
+ * access time where permitted, and read with a single read(2) of one byte
+ * more than its size (so that a file which grew is noticed without a
+ * second read): there is no buffer and no hash to set up, which is most
+ * of the cost of a small file.
+ */
+class fslurp {
+   private:
+      std::string _dir; // directory of the last file
+      int _fd;          // and its descriptor (-1: none)
+
+      fslurp(const fslurp&);
+      fslurp& operator=(const fslurp&);
+
+   public:
+
+      fslurp(): _fd(-1) {}
+
+      ~fslurp();
+
+      /** Read a file.
+        * @param path path name
+        * @param b destination, with room for n + 1 bytes
+        * @param n size of the file
+        * @return 0, or why the file could not be read (or has changed)
+        */
+      const char* read(const std::string& path, char* b, size_t n);
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// SCAN JOURNALS - IMPLEMENTATION
+//
+
+#include <fjournal.h>
+
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+}
+
+static int __hex(char c) {
+   if (c >= '0' && c <= '9') return c - '0';
+   if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+   return -1;
+}
+
+static void __hex(FILE* f, const unsigned char* md5) {
+   for(int i = 0; i < 16; ++i) 
+      ::fprintf(f,"%c%c","0123456789abcdef"[md5[i] >> 4],
+         "0123456789abcdef"[md5[i] & 0x0f]);
+}
+
+fjournal::fjournal(const std::string& dir, const std::string& opts, 
+   bool resume) throw(const char*): _path(dir + "/journal"), _f(0), 
+   _synced(::time(0)), _complete(false), _skipped(false) {
+   if (::mkdir(dir.c_str(),0777) && errno != EEXIST) 
+      throw "Could not create the journal directory";
+
+   struct stat st;
+   bool exists = !::stat(_path.c_str(),&st);
+   if (exists && !resume) throw "There is a journal (--resume?)";
+   if (resume && exists) load(opts);
+
+   _f = ::fopen(_path.c_str(),resume && exists ? "a" : "w");
+   if (!_f) throw "Could not open the journal";
+   ::setvbuf(_f,0,_IOFBF,1 << 20);
+   if (!resume || !exists) {
+      ::fprintf(_f,"#ua-journal 1 %s\n",opts.size() ? opts.c_str() : "-");
+      flush();
+   }
+}
+
+fjournal::~fjournal() {
+   flush();
+   ::fclose(_f);
+}
+
+void fjournal::load(const std::string& opts) throw(const char*) {
+   std::ifstream is(_path.c_str());
+   if (!is) throw "Could not open the journal";
+
+   std::string line;
+   std::getline(is,line);
+   std::istringstream hs(line);
+   std::string magic, o;
+   int version = 0;
+   hs >> magic >> version >> o;
+   if (!hs || magic != "#ua-journal") throw "Not a ua journal";
+   if (version != 1) throw "Unknown journal version";
+   if (o != (opts.size() ? opts : "-")) throw "Journal of other options";
+
+   off_t good = line.size() + 1; // the end of the last whole record
+   while(std::getline(is,line)) {
+      if (is.eof()) break; // torn (no newline)
+      const char* p = line.c_str();
+      char* e;
+      if (line == "E") _complete = true;
+      else if (!line.compare(0,2,"S ")) {
+         size_t s = ::strtoul(p + 2,&e,10);
+         if (e == p + 2 || *e != ' ') break;
+         std::string path(e + 1);
+         if (_sizes.insert(std::make_pair(path,s)).second) 
+            _files.push_back(path);
+      } else if (!line.compare(0,2,"H ")) {
+         size_t m = ::strtoul(p + 2,&e,10);
+         if (e == p + 2 || *e != ' ' || line.size() < (size_t)(e - p) + 35 ||
+            e[33] != ' ') break;
+         md5_t d;
+         int k;
+         for(k = 0; k < 16; ++k) {
+            int hi = __hex(e[1 + 2 * k]), lo = __hex(e[2 + 2 * k]);
+            if (hi < 0 || lo < 0) break;
+            d.b[k] = hi << 4 | lo;
+         }
+         if (k < 16) break;
+         _digests[std::make_pair(m,std::string(e + 34))] = d;
+      } else break;
+      good += line.size() + 1;
+   }
+   is.close();
+
+   // drop what follows the last whole record
+   if (::truncate(_path.c_str(),good)) throw "Could not repair the journal";
+}
+
+void fjournal::tick() {
+   if (::time(0) - _synced >= __UAJOURNALSYNC) flush();
+}
+
+void fjournal::flush() {
+   ::fflush(_f);
+   ::fdatasync(::fileno(_f));
+   _synced = ::time(0);
+}
+
+bool fjournal::size(const std::string& path, size_t& s) const {
+   std::map<std::string,size_t>::const_iterator it = _sizes.find(path);
+   if (it == _sizes.end()) return false;
+   s = it->second;
+   return true;
+}
+
+bool fjournal::digest(const std::string& path, size_t m, unsigned char* md5)
+   const {
+   std::map<std::pair<size_t,std::string>,md5_t>::const_iterator it = 
+      _digests.find(std::make_pair(m,path));
+   if (it == _digests.end()) return false;
+   ::memcpy(md5,it->second.b,16);
+   return true;
+}
+
+void fjournal::stat(const std::string& path, size_t s) {
+   if (path.find('\n') != std::string::npos) {
+      _skipped = true;
+      return;
+   }
+   ::fprintf(_f,"S %lu %s\n",(unsigned long)s,path.c_str());
+   tick();
+}
+
+void fjournal::stated() {
+   if (!_skipped) ::fprintf(_f,"E\n");
+   flush();
+}
+
+void fjournal::hashed(const std::string& path, size_t m, 
+   const unsigned char* md5) {
+   if (path.find('\n') != std::string::npos) return;
+   ::fprintf(_f,"H %lu ",(unsigned long)m);
+   __hex(_f,md5);
+   ::fprintf(_f," %s\n",path.c_str());
+   tick();
+}
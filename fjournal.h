@@ -0,0 +1,169 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// SCAN JOURNALS - HEADER
+//
+
+#if !defined(_FJOURNAL_H_)
+#define _FJOURNAL_H_
+
+// how often the journal is flushed to the disk (s)
+//
+#if !defined(__UAJOURNALSYNC)
+#define __UAJOURNALSYNC 5
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+extern "C" {
+#include <stdio.h>
+#include <time.h>
+}
+
+/** Journal of a scan, to resume it after a crash.
+ *
+ * An append-only log in a directory (the file "journal" in it): a header
+ * <pre>
+ *    #ua-journal 1 &lt;options&gt;
+ * </pre>
+ * with the options affecting the sizes and the hashes, then the records
+ * <pre>
+ *    S &lt;size&gt; &lt;path&gt;       a file stat'ed
+ *    E                      all the files are stat'ed
+ *    H &lt;max&gt; &lt;md5 hex&gt; &lt;path&gt;  a hash (of the first max bytes, 0: all)
+ * </pre>
+ * The records are buffered and flushed (and synced) every 
+ * __UAJOURNALSYNC seconds, and when the journal is closed; a torn last
+ * record is dropped when the journal is opened again. What a resumed run
+ * looks up is what the journal held when it was opened, the records it 
+ * adds are for the next run. Paths with newlines are not journaled (and
+ * the stats are not complete then).
+ *
+ * <pre>
+ *    fjournal j(dir,opts,true);
+ *    size_t s;
+ *    if (!j.size(path,s)) j.stat(path,s = ...);
+ *    ...
+ *    j.stated();
+ *    ...
+ *    if (!j.digest(path,max,md5)) j.hashed(path,max,...);
+ * </pre>
+ */
+class fjournal {
+   private:
+      struct md5_t { unsigned char b[16]; };
+
+      std::string _path;
+      FILE* _f;
+      time_t _synced; // last flush
+      bool _complete; // the journal has E
+      bool _skipped; // a file was not journaled (no E then)
+      std::vector<std::string> _files; // in the order they were stat'ed
+      std::map<std::string,size_t> _sizes;
+      std::map<std::pair<size_t,std::string>,md5_t> _digests;
+
+      void load(const std::string& opts) throw(const char*);
+      void tick(); // flush if it is time
+
+      fjournal(const fjournal&);
+      fjournal& operator=(const fjournal&);
+
+   public:
+
+      /** Open a journal.
+        * @param dir the directory of the journal (created if need be)
+        * @param opts the options of the scan (no white space)
+        * @param resume continue the journal there (a new one otherwise)
+        * @throws a description if it cannot be opened, if there is a 
+        *   journal when not resuming or if it is for other options
+        */
+      fjournal(const std::string& dir, const std::string& opts, bool resume)
+      throw(const char*);
+
+      /** Destructor, flushes the journal.
+       */
+      ~fjournal();
+
+      /** Whether all the files were stat'ed before.
+        */
+      bool complete() const { return _complete; }
+
+      /** Files stat'ed before.
+        */
+      const std::vector<std::string>& files() const { return _files; }
+
+      /** Number of hashes known from before.
+        */
+      size_t digests() const { return _digests.size(); }
+
+      /** The size of a file stat'ed before.
+        * @param path path name
+        * @param s the size (returned)
+        * @return false if it was not
+        */
+      bool size(const std::string& path, size_t& s) const;
+
+      /** The hash of a file calculated before.
+        * @param path path name
+        * @param m the hash is of the first m bytes (0: all)
+        * @param md5 the hash (returned)
+        * @return false if it was not calculated
+        */
+      bool digest(const std::string& path, size_t m, unsigned char* md5) 
+         const;
+
+      /** Journal a stat.
+        * @param path path name
+        * @param s size
+        */
+      void stat(const std::string& path, size_t s);
+
+      /** Journal the end of the stats.
+        */
+      void stated();
+
+      /** Journal a hash.
+        * @param path path name
+        * @param m the hash is of the first m bytes (0: all)
+        * @param md5 the hash
+        */
+      void hashed(const std::string& path, size_t m, 
+         const unsigned char* md5);
+
+      /** Flush the records to the disk.
+        */
+      void flush();
+};
+
+#endif
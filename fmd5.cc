@@ -0,0 +1,185 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MULTI-BUFFER MD5 - IMPLEMENTATION
+//
+
+#include <fmd5.h>
+
+extern "C" {
+#include <string.h>
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define __UAMD5X86
+#endif
+
+typedef uint32_t __v4 __attribute__((vector_size(16)));
+typedef uint32_t __v8 __attribute__((vector_size(32)));
+typedef uint32_t __v16 __attribute__((vector_size(64)));
+
+// the block of idle lanes
+static const unsigned char __zero[64] = { 0 };
+
+#define __F(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))
+#define __G(x,y,z) ((y) ^ ((z) & ((x) ^ (y))))
+#define __H(x,y,z) ((x) ^ (y) ^ (z))
+#define __I(x,y,z) ((y) ^ ((x) | ~(z)))
+
+#define __STEP(f,a,b,c,d,k,s,t) \
+   a += f(b,c,d) + w[k] + (uint32_t)t; \
+   a = (a << s) | (a >> (32 - s)); \
+   a += b;
+
+// one block in each of the L lanes of V
+template<class V, int L> static inline __attribute__((always_inline)) 
+void __compress(uint32_t* st, const unsigned char* const* blocks) {
+   uint32_t x[16 * L];
+   for(int l = 0; l < L; ++l) {
+      const unsigned char* p = blocks[l] ? blocks[l] : __zero;
+      for(int i = 0; i < 16; ++i, p += 4) 
+         x[i * L + l] = (uint32_t)p[0] | (uint32_t)p[1] << 8 | 
+            (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+   }
+
+   V w[16];
+   for(int i = 0; i < 16; ++i) ::memcpy(&w[i],x + i * L,sizeof(V));
+
+   V a, b, c, d;
+   ::memcpy(&a,st,sizeof(V));
+   ::memcpy(&b,st + L,sizeof(V));
+   ::memcpy(&c,st + 2 * L,sizeof(V));
+   ::memcpy(&d,st + 3 * L,sizeof(V));
+   V aa = a, bb = b, cc = c, dd = d;
+
+   __STEP(__F,a,b,c,d, 0, 7,0xd76aa478) __STEP(__F,d,a,b,c, 1,12,0xe8c7b756)
+   __STEP(__F,c,d,a,b, 2,17,0x242070db) __STEP(__F,b,c,d,a, 3,22,0xc1bdceee)
+   __STEP(__F,a,b,c,d, 4, 7,0xf57c0faf) __STEP(__F,d,a,b,c, 5,12,0x4787c62a)
+   __STEP(__F,c,d,a,b, 6,17,0xa8304613) __STEP(__F,b,c,d,a, 7,22,0xfd469501)
+   __STEP(__F,a,b,c,d, 8, 7,0x698098d8) __STEP(__F,d,a,b,c, 9,12,0x8b44f7af)
+   __STEP(__F,c,d,a,b,10,17,0xffff5bb1) __STEP(__F,b,c,d,a,11,22,0x895cd7be)
+   __STEP(__F,a,b,c,d,12, 7,0x6b901122) __STEP(__F,d,a,b,c,13,12,0xfd987193)
+   __STEP(__F,c,d,a,b,14,17,0xa679438e) __STEP(__F,b,c,d,a,15,22,0x49b40821)
+
+   __STEP(__G,a,b,c,d, 1, 5,0xf61e2562) __STEP(__G,d,a,b,c, 6, 9,0xc040b340)
+   __STEP(__G,c,d,a,b,11,14,0x265e5a51) __STEP(__G,b,c,d,a, 0,20,0xe9b6c7aa)
+   __STEP(__G,a,b,c,d, 5, 5,0xd62f105d) __STEP(__G,d,a,b,c,10, 9,0x02441453)
+   __STEP(__G,c,d,a,b,15,14,0xd8a1e681) __STEP(__G,b,c,d,a, 4,20,0xe7d3fbc8)
+   __STEP(__G,a,b,c,d, 9, 5,0x21e1cde6) __STEP(__G,d,a,b,c,14, 9,0xc33707d6)
+   __STEP(__G,c,d,a,b, 3,14,0xf4d50d87) __STEP(__G,b,c,d,a, 8,20,0x455a14ed)
+   __STEP(__G,a,b,c,d,13, 5,0xa9e3e905) __STEP(__G,d,a,b,c, 2, 9,0xfcefa3f8)
+   __STEP(__G,c,d,a,b, 7,14,0x676f02d9) __STEP(__G,b,c,d,a,12,20,0x8d2a4c8a)
+
+   __STEP(__H,a,b,c,d, 5, 4,0xfffa3942) __STEP(__H,d,a,b,c, 8,11,0x8771f681)
+   __STEP(__H,c,d,a,b,11,16,0x6d9d6122) __STEP(__H,b,c,d,a,14,23,0xfde5380c)
+   __STEP(__H,a,b,c,d, 1, 4,0xa4beea44) __STEP(__H,d,a,b,c, 4,11,0x4bdecfa9)
+   __STEP(__H,c,d,a,b, 7,16,0xf6bb4b60) __STEP(__H,b,c,d,a,10,23,0xbebfbc70)
+   __STEP(__H,a,b,c,d,13, 4,0x289b7ec6) __STEP(__H,d,a,b,c, 0,11,0xeaa127fa)
+   __STEP(__H,c,d,a,b, 3,16,0xd4ef3085) __STEP(__H,b,c,d,a, 6,23,0x04881d05)
+   __STEP(__H,a,b,c,d, 9, 4,0xd9d4d039) __STEP(__H,d,a,b,c,12,11,0xe6db99e5)
+   __STEP(__H,c,d,a,b,15,16,0x1fa27cf8) __STEP(__H,b,c,d,a, 2,23,0xc4ac5665)
+
+   __STEP(__I,a,b,c,d, 0, 6,0xf4292244) __STEP(__I,d,a,b,c, 7,10,0x432aff97)
+   __STEP(__I,c,d,a,b,14,15,0xab9423a7) __STEP(__I,b,c,d,a, 5,21,0xfc93a039)
+   __STEP(__I,a,b,c,d,12, 6,0x655b59c3) __STEP(__I,d,a,b,c, 3,10,0x8f0ccc92)
+   __STEP(__I,c,d,a,b,10,15,0xffeff47d) __STEP(__I,b,c,d,a, 1,21,0x85845dd1)
+   __STEP(__I,a,b,c,d, 8, 6,0x6fa87e4f) __STEP(__I,d,a,b,c,15,10,0xfe2ce6e0)
+   __STEP(__I,c,d,a,b, 6,15,0xa3014314) __STEP(__I,b,c,d,a,13,21,0x4e0811a1)
+   __STEP(__I,a,b,c,d, 4, 6,0xf7537e82) __STEP(__I,d,a,b,c,11,10,0xbd3af235)
+   __STEP(__I,c,d,a,b, 2,15,0x2ad7d2bb) __STEP(__I,b,c,d,a, 9,21,0xeb86d391)
+
+   a += aa, b += bb, c += cc, d += dd;
+   ::memcpy(st,&a,sizeof(V));
+   ::memcpy(st + L,&b,sizeof(V));
+   ::memcpy(st + 2 * L,&c,sizeof(V));
+   ::memcpy(st + 3 * L,&d,sizeof(V));
+}
+
+static void __md5x4(uint32_t* st, const unsigned char* const* blocks) {
+   __compress<__v4,4>(st,blocks);
+}
+
+#if defined(__UAMD5X86)
+__attribute__((target("avx2")))
+static void __md5x8(uint32_t* st, const unsigned char* const* blocks) {
+   __compress<__v8,8>(st,blocks);
+}
+
+__attribute__((target("avx512f")))
+static void __md5x16(uint32_t* st, const unsigned char* const* blocks) {
+   __compress<__v16,16>(st,blocks);
+}
+#else
+static void __md5x8(uint32_t* st, const unsigned char* const* blocks) {
+   __compress<__v8,8>(st,blocks);
+}
+
+static void __md5x16(uint32_t* st, const unsigned char* const* blocks) {
+   __compress<__v16,16>(st,blocks);
+}
+#endif
+
+int fmd5::simd() {
+#if defined(__UAMD5X86)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512f")) return 16;
+   if (__builtin_cpu_supports("avx2")) return 8;
+#endif
+   return 4;
+}
+
+fmd5::fmd5(int lanes): _n(lanes ? lanes : simd()) {
+   switch(_n) {
+      case 16: _f = &__md5x16; break;
+      case 8: _f = &__md5x8; break;
+      default: _n = 4; _f = &__md5x4;
+   }
+   ::memset(_st,0,sizeof(_st));
+}
+
+void fmd5::init(int l) {
+   _st[l] = 0x67452301;
+   _st[_n + l] = 0xefcdab89;
+   _st[2 * _n + l] = 0x98badcfe;
+   _st[3 * _n + l] = 0x10325476;
+}
+
+void fmd5::compress(const unsigned char* const* blocks) {
+   (*_f)(_st,blocks);
+}
+
+void fmd5::get(int l, unsigned char* md5) const {
+   for(int k = 0; k < 4; ++k) {
+      uint32_t v = _st[k * _n + l];
+      md5[4 * k] = v, md5[4 * k + 1] = v >> 8;
+      md5[4 * k + 2] = v >> 16, md5[4 * k + 3] = v >> 24;
+   }
+}
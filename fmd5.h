@@ -0,0 +1,103 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MULTI-BUFFER MD5 - HEADER
+//
+
+#if !defined(_FMD5_H_)
+#define _FMD5_H_
+
+extern "C" {
+#include <stdint.h>
+}
+
+/** Multi-buffer MD5.
+ *
+ * MD5 is serial within a message, but independent messages can be 
+ * hashed side by side: each lane of a SIMD register holds the state of
+ * another message, and one compression advances all of them by a 64
+ * byte block. There are 4 lanes with SSE2 (or any other target of the
+ * GCC vector extensions), 8 with AVX2 and 16 with AVX-512; the widest 
+ * the CPU supports is chosen at run time.
+ *
+ * The caller does the padding: the lanes only see whole blocks, and the
+ * digest of a lane is its state after the last (padding) block. So the
+ * digests are those of any other MD5.
+ *
+ * <pre>
+ *    fmd5 x;
+ *    for(int l = 0; l < x.lanes(); ++l) x.init(l);
+ *    x.compress(blocks); // blocks[l]: next 64 bytes of lane l (or 0)
+ *    ...
+ *    x.get(l,md5);
+ * </pre>
+ */
+class fmd5 {
+   private:
+      int _n;            // lanes
+      uint32_t _st[64];  // a, b, c and d of the lanes (a of each, b ...)
+      void (*_f)(uint32_t*, const unsigned char* const*);
+
+   public:
+
+      /** Constructor.
+       * @param lanes 4, 8 or 16 (0: the most the CPU supports)
+       */
+      fmd5(int lanes = 0);
+
+      /** Number of lanes.
+       * @return the messages hashed at once
+       */
+      int lanes() const { return _n; }
+
+      /** Start a message in a lane.
+       * @param l the lane
+       */
+      void init(int l);
+
+      /** Compress a block in each lane.
+       * @param blocks the next 64 bytes of each lane, 0 for idle lanes
+       */
+      void compress(const unsigned char* const* blocks);
+
+      /** The digest of a lane.
+       * @param l the lane
+       * @param md5 the 16 bytes (returned)
+       */
+      void get(int l, unsigned char* md5) const;
+
+      /** The most lanes of the CPU.
+       * @return 4, 8 or 16
+       */
+      static int simd();
+};
+
+#endif
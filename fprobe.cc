@@ -0,0 +1,129 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// TRACEPOINTS AND LATENCY HISTOGRAMS - IMPLEMENTATION
+//
+
+#include <fprobe.h>
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <iomanip>
+
+extern "C" {
+#include <time.h>
+#include <pthread.h>
+}
+
+// the slowest files kept (the report prints at most these many)
+static const int __SLOWEST = 1000;
+
+// buckets: [2^k, 2^(k+1)) us, the first from 0
+static const int __BUCKETS = 32;
+
+static const char* __names[] = { "open", "read", "hash" };
+
+static pthread_mutex_t __m = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long __hist[fprobe::KINDS][__BUCKETS];
+static double __sum[fprobe::KINDS];
+static double __max[fprobe::KINDS];
+
+// a min heap of the slowest files to hash
+typedef std::pair<double,std::string> __slow_t;
+static std::vector<__slow_t> __slow;
+
+bool fprobe::_on = false;
+
+double fprobe::now() {
+   struct timespec ts;
+   ::clock_gettime(CLOCK_MONOTONIC,&ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fprobe::add(what_t w, double s, const char* path) {
+   unsigned long us = (unsigned long)(s * 1e6);
+   int b = 0;
+   while(us > 1 && b < __BUCKETS - 1) us >>= 1, ++b;
+
+   ::pthread_mutex_lock(&__m);
+   ++__hist[w][b];
+   __sum[w] += s;
+   __max[w] = std::max(__max[w],s);
+   if (path && w == HASH) {
+      if (__slow.size() < (size_t)__SLOWEST) {
+         __slow.push_back(__slow_t(s,path));
+         std::push_heap(__slow.begin(),__slow.end(),std::greater<__slow_t>());
+      } else if (s > __slow.front().first) {
+         std::pop_heap(__slow.begin(),__slow.end(),std::greater<__slow_t>());
+         __slow.back() = __slow_t(s,path);
+         std::push_heap(__slow.begin(),__slow.end(),std::greater<__slow_t>());
+      }
+   }
+   ::pthread_mutex_unlock(&__m);
+}
+
+void fprobe::report(std::ostream& os, int n) {
+   ::pthread_mutex_lock(&__m);
+
+   for(int w = 0; w < KINDS; ++w) {
+      unsigned long tot = 0, most = 0;
+      int lo = __BUCKETS, hi = -1;
+      for(int b = 0; b < __BUCKETS; ++b) {
+         if (!__hist[w][b]) continue;
+         tot += __hist[w][b], most = std::max(most,__hist[w][b]);
+         lo = std::min(lo,b), hi = b;
+      }
+      os << __names[w] << " latency (us): " << tot;
+      if (!tot) { os << std::endl; continue; }
+      os << ", mean " << std::fixed << std::setprecision(1) 
+         << __sum[w] / tot * 1e6 << ", max " << __max[w] * 1e6 << std::endl;
+      for(int b = lo; b <= hi; ++b) {
+         std::ostringstream r;
+         r << "[" << (b ? 1ul << b : 0) << ", " << (2ul << b) << ")";
+         os << "   " << std::left << std::setw(24) << r.str() << std::right 
+            << std::setw(10) << __hist[w][b] << " |" 
+            << std::string(__hist[w][b] * 40 / most,'@') << std::endl;
+      }
+   }
+
+   std::vector<__slow_t> slow(__slow);
+   ::pthread_mutex_unlock(&__m);
+
+   std::sort(slow.begin(),slow.end(),std::greater<__slow_t>());
+   if (n > (int)slow.size()) n = slow.size();
+   if (n) os << "slowest files to hash (s):" << std::endl;
+   for(int i = 0; i < n; ++i) 
+      os << "   " << std::fixed << std::setprecision(3) << slow[i].first 
+         << " " << slow[i].second << std::endl;
+}
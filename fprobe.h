@@ -0,0 +1,122 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// TRACEPOINTS AND LATENCY HISTOGRAMS - HEADER
+//
+
+#if !defined(_FPROBE_H_)
+#define _FPROBE_H_
+
+#if defined(HAVE_CONFIG_H)
+#include <config.h>
+#endif
+
+// static tracepoints (USDT) of the provider ua, for bpftrace or perf:
+//
+//    ua:open__start(path)         ua:open__done(path, fd)
+//    ua:read__done(fd, bytes)
+//    ua:calc__start(path, max)    ua:calc__done(path, bytes)
+//    ua:digest(path, md5)
+//    ua:eq__start(path1, path2)   ua:eq__done(path1, path2, same)
+//    ua:hashn__start(files)       ua:hashn__done(files)
+//    ua:common__start(sets)       ua:common__done(sets)
+//
+// eg. bpftrace -e 'usdt:./ua:ua:open__done { @[arg1 < 0] = count(); }'
+// a probe is a nop unless something is attached to it
+//
+#if defined(HAVE_SYS_SDT_H)
+#include <sys/sdt.h>
+#define __UAPROBE1(n,a) DTRACE_PROBE1(ua,n,a)
+#define __UAPROBE2(n,a,b) DTRACE_PROBE2(ua,n,a,b)
+#define __UAPROBE3(n,a,b,c) DTRACE_PROBE3(ua,n,a,b,c)
+#else
+#define __UAPROBE1(n,a)
+#define __UAPROBE2(n,a,b)
+#define __UAPROBE3(n,a,b,c)
+#endif
+
+#include <string>
+#include <iostream>
+
+/** Latency histograms.
+ *
+ * When on, the time of each open, each read and the hash of each file is
+ * added to a histogram with log2 buckets (in microseconds), and the
+ * files that took the longest to hash are kept. When off (the default),
+ * the only cost is testing fprobe::_on.
+ *
+ * <pre>
+ *    fprobe::_on = true;
+ *    double t = fprobe::now();
+ *    ...
+ *    fprobe::add(fprobe::OPEN,fprobe::now() - t);
+ *    ...
+ *    fprobe::report(std::cerr,10);
+ * </pre>
+ * All of it is thread safe.
+ */
+class fprobe {
+
+   public:
+
+      /** What is timed.
+       */
+      enum what_t {
+         OPEN = 0, // open(2)
+         READ,     // read(2)
+         HASH,     // a file, from open to digest
+         KINDS
+      };
+
+      /** Whether to time (default false).
+       */
+      static bool _on;
+
+      /** The time.
+       * @return seconds (monotonic)
+       */
+      static double now();
+
+      /** Add a latency.
+       * @param w what took it
+       * @param s seconds
+       * @param path the file (kept if one of the slowest to hash)
+       */
+      static void add(what_t w, double s, const char* path = 0);
+
+      /** Print the histograms and the slowest files.
+       * @param os output
+       * @param n number of the slowest files
+       */
+      static void report(std::ostream& os, int n);
+};
+
+#endif
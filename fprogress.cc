@@ -0,0 +1,271 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// PROGRESS REPORTING - IMPLEMENTATION
+//
+
+#include <fprogress.h>
+
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <fstream>
+#include <iostream>
+
+extern "C" {
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+}
+
+void (*fprogress::_next)(size_t) = 0;
+
+static const char* __names[] = { "stat", "hash", "full" };
+
+// a watched queue
+struct __queue {
+   const char* name;
+   size_t (*depth)(const void*);
+   const void* q;
+};
+
+static pthread_mutex_t __m = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t __files[fprogress::STAGES];
+static uint64_t __bytes[fprogress::STAGES];
+static size_t __tfiles[fprogress::STAGES];  // totals
+static uint64_t __tbytes[fprogress::STAGES];
+static bool __known = false; // whether there are totals
+static uint64_t __rk = 0;     // bytes read by then
+static std::vector<__queue> __queues;
+
+static volatile uint64_t __read = 0; // bytes read (__sync builtins)
+
+static double __t0 = 0;     // start
+static double __tl = 0;     // last refresh
+static uint64_t __rl = 0;   // bytes read by then
+static double __rate = 0;   // read rate in the last period (bytes/s)
+static double __moved = 0;  // when something was read last
+
+static pthread_t __t;
+static bool __running = false;
+static volatile bool __stop = false;
+static bool __show = false;
+static std::string __file;
+
+static double __now() {
+   struct timespec ts;
+   ::clock_gettime(CLOCK_MONOTONIC,&ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// bytes for humans
+static std::string __size(uint64_t b) {
+   static const char* units = "BKMGTP";
+   double v = b;
+   int u = 0;
+   while(v >= 1024 && u < 5) v /= 1024, ++u;
+   std::ostringstream os;
+   if (u) os << std::fixed << std::setprecision(1);
+   os << v << units[u];
+   return os.str();
+}
+
+// seconds for humans
+static std::string __time(double s) {
+   long t = (long)s;
+   std::ostringstream os;
+   os << t / 3600 << ":" << std::setfill('0') << std::setw(2) 
+      << t / 60 % 60 << ":" << std::setw(2) << t % 60;
+   return os.str();
+}
+
+// measure the read rate (under __m)
+static void __measure() {
+   double t = __now();
+   uint64_t r = __read;
+   if (t - __tl > 0) __rate = (r - __rl) / (t - __tl);
+   if (r != __rl) __moved = t;
+   __tl = t, __rl = r;
+}
+
+// show the status (outside __m)
+static void __refresh(bool dump) {
+   std::string line = fprogress::snapshot();
+   if (dump) {
+      std::cerr << line << std::endl;
+   } else if (__file.size()) {
+      std::string tmp = __file + ".tmp";
+      {
+         std::ofstream os(tmp.c_str());
+         os << line << std::endl;
+         if (!os) return;
+      }
+      ::rename(tmp.c_str(),__file.c_str());
+   } else if (::isatty(2)) {
+      std::cerr << "\r" << line << "\033[K" << std::flush;
+   } else std::cerr << line << std::endl;
+}
+
+static void* __status(void*) {
+   sigset_t ss;
+   ::sigemptyset(&ss);
+   ::sigaddset(&ss,SIGUSR1);
+   struct timespec p;
+   p.tv_sec = __UAPROGPERIOD / 1000;
+   p.tv_nsec = (__UAPROGPERIOD % 1000) * 1000000L;
+
+   while(!__stop) {
+      int sig = __show ? ::sigtimedwait(&ss,0,&p) : ::sigwaitinfo(&ss,0);
+      if (__stop) break;
+      if (sig == SIGUSR1) {
+         __refresh(true);
+      } else if (sig < 0 && errno == EAGAIN) {
+         ::pthread_mutex_lock(&__m);
+         __measure();
+         ::pthread_mutex_unlock(&__m);
+         __refresh(false);
+      }
+   }
+   return 0;
+}
+
+void fprogress::start(bool show, const std::string& file) {
+   if (__running) return;
+   __show = show, __file = file, __stop = false;
+   __t0 = __tl = __moved = __now();
+
+   sigset_t ss;
+   ::sigemptyset(&ss);
+   ::sigaddset(&ss,SIGUSR1);
+   ::pthread_sigmask(SIG_BLOCK,&ss,0);
+   __running = !::pthread_create(&__t,0,&__status,0);
+}
+
+void fprogress::stop() {
+   if (!__running) return;
+   __stop = true;
+   ::pthread_kill(__t,SIGUSR1);
+   ::pthread_join(__t,0);
+   __running = false;
+
+   if (__show) {
+      ::pthread_mutex_lock(&__m);
+      __measure();
+      ::pthread_mutex_unlock(&__m);
+      if (__file.empty() && ::isatty(2)) {
+         __refresh(false);
+         std::cerr << std::endl;
+      } else __refresh(false);
+   }
+}
+
+void fprogress::total(stage_t s, size_t files, uint64_t bytes) {
+   ::pthread_mutex_lock(&__m);
+   __tfiles[s] += files;
+   __tbytes[s] += bytes;
+   if (!__known) __rk = __read;
+   __known = true;
+   ::pthread_mutex_unlock(&__m);
+}
+
+void fprogress::done(stage_t s, size_t files, uint64_t bytes) {
+   ::pthread_mutex_lock(&__m);
+   __files[s] += files;
+   __bytes[s] += bytes;
+   ::pthread_mutex_unlock(&__m);
+}
+
+void fprogress::watch(const char* name, size_t (*depth)(const void*), 
+   const void* q) {
+   ::pthread_mutex_lock(&__m);
+   std::vector<__queue>::iterator i = __queues.begin();
+   while(i != __queues.end() && std::string(i->name) != name) ++i;
+   if (i != __queues.end()) __queues.erase(i);
+   if (q) {
+      __queue w = { name, depth, q };
+      __queues.push_back(w);
+   }
+   ::pthread_mutex_unlock(&__m);
+}
+
+void fprogress::read(size_t n) {
+   __sync_fetch_and_add(&__read,(uint64_t)n);
+   if (_next) (*_next)(n);
+}
+
+uint64_t fprogress::bytes() {
+   return __sync_fetch_and_add(&__read,(uint64_t)0);
+}
+
+std::string fprogress::snapshot() {
+   std::ostringstream os;
+   ::pthread_mutex_lock(&__m);
+
+   double t = __now();
+   os << "ua: ";
+   for(int s = 0; s < STAGES; ++s) {
+      if (s) os << ", ";
+      os << __names[s] << " " << __files[s];
+      if (__tfiles[s]) os << "/" << __tfiles[s];
+      os << " files " << __size(__bytes[s]);
+      if (__tbytes[s]) os << "/" << __size(__tbytes[s]);
+   }
+   os << ", " << std::fixed << std::setprecision(1) << __rate / 1048576 
+      << " MB/s";
+   if (t - __moved >= 5 * __UAPROGPERIOD / 1000.0) 
+      os << " (nothing read for " << __time(t - __moved) << ")";
+
+   if (__queues.size()) {
+      os << ", queued";
+      for(int i = 0; i < (int)__queues.size(); ++i) 
+         os << " " << __queues[i].name << " " 
+            << (*__queues[i].depth)(__queues[i].q);
+   }
+
+   // from the average rate so far, and what has been read since the
+   // totals are known (the files of a group are done all at once)
+   uint64_t tot = 0, did = 0;
+   for(int s = HASH; s < STAGES; ++s) tot += __tbytes[s], did += __bytes[s];
+   did = std::max(did,(uint64_t)(__read - __rk));
+   uint64_t left = tot > did ? tot - did : 0;
+   double avg = t > __t0 ? __read / (t - __t0) : 0;
+   os << ", ETA ";
+   if (__known && avg > 0) os << __time(left / avg);
+   else os << "-";
+
+   ::pthread_mutex_unlock(&__m);
+   return os.str();
+}
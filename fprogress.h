@@ -0,0 +1,140 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// PROGRESS REPORTING - HEADER
+//
+
+#if !defined(_FPROGRESS_H_)
+#define _FPROGRESS_H_
+
+// how often the status is refreshed (ms)
+//
+#if !defined(__UAPROGPERIOD)
+#define __UAPROGPERIOD 1000
+#endif
+
+#include <string>
+
+extern "C" {
+#include <stdint.h>
+}
+
+/** Progress of a scan.
+ *
+ * The scan counts the files and bytes it is done with in each stage
+ * (stat, hash and full hash) and sets the totals of a stage when they 
+ * are known; the bytes read come from filei::_rdhook. A thread turns
+ * the counters into a status line: files and bytes done per stage, 
+ * the read rate, the depths of the queues being watched and an ETA.
+ * It writes the line to stderr (in place on a terminal) or to a status
+ * file every __UAPROGPERIOD ms, and dumps it to stderr on SIGUSR1 in any
+ * case. When nothing has been read for a while, the line tells for how
+ * long, so a stalled (network) file system shows up as such.
+ *
+ * <pre>
+ *    fprogress::start(true);
+ *    fprogress::_next = filei::_rdhook;
+ *    filei::_rdhook = &fprogress::read;
+ *    ...
+ *    fprogress::done(fprogress::HASH,n,bytes);
+ *    ...
+ *    fprogress::stop();
+ * </pre>
+ * SIGUSR1 is blocked in the thread calling start() (and the threads it
+ * creates later), the status thread waits for it. All of it is thread
+ * safe.
+ */
+class fprogress {
+
+   public:
+
+      /** Stages of a scan.
+       */
+      enum stage_t {
+         STAT = 0, // stat'ing the files
+         HASH,     // hashing (the prefixes with -2) or comparing
+         FULL,     // hashing the rest (second stage)
+         STAGES
+      };
+
+      /** Start the status thread.
+       * @param show refresh the status every __UAPROGPERIOD ms
+       * @param file refresh it in this file (empty: on stderr)
+       */
+      static void start(bool show, const std::string& file = std::string());
+
+      /** Stop the status thread (the last status is shown).
+       */
+      static void stop();
+
+      /** Add to the totals of a stage.
+       * @param s the stage
+       * @param files number of files
+       * @param bytes number of bytes
+       */
+      static void total(stage_t s, size_t files, uint64_t bytes);
+
+      /** Add to the work done in a stage.
+       * @param s the stage
+       * @param files number of files
+       * @param bytes number of bytes
+       */
+      static void done(stage_t s, size_t files, uint64_t bytes);
+
+      /** Watch the depth of a queue.
+       * @param name name of the queue
+       * @param depth returns the depth of q
+       * @param q the queue (0: do not watch it any more)
+       */
+      static void watch(const char* name, size_t (*depth)(const void*), 
+         const void* q);
+
+      /** Count the bytes read (for filei::_rdhook).
+       * @param n number of bytes
+       */
+      static void read(size_t n);
+
+      /** Bytes read so far.
+       * @return the bytes counted by read()
+       */
+      static uint64_t bytes();
+
+      /** The hook called by read() (eg. fthrottle::read, 0: none).
+       */
+      static void (*_next)(size_t);
+
+      /** The status line.
+       * @return files and bytes per stage, rate, queues and ETA
+       */
+      static std::string snapshot();
+};
+
+#endif
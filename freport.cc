@@ -0,0 +1,209 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MERGEABLE REPORTS OF IDENTICAL FILES - IMPLEMENTATION
+//
+
+#include <freport.h>
+
+#include <sstream>
+
+extern "C" {
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+}
+
+bool fgroup::operator<(const fgroup& g) const {
+   int c = ::memcmp(md5,g.md5,16);
+   return c < 0 || (!c && size < g.size);
+}
+
+bool fgroup::same(const fgroup& g) const {
+   return size == g.size && !::memcmp(md5,g.md5,16);
+}
+
+void freport::write(std::ostream& os, const header& h) {
+   os << "#ua-report 1 " << h.shard << "/" << h.shards << " " 
+      << (h.opts.size() ? h.opts : "-") << "\n";
+}
+
+void freport::write(std::ostream& os, const fgroup& g) {
+   os << "G " << std::dec << g.size << " ";
+   for(int i = 0; i < 16; ++i) 
+      os << "0123456789abcdef"[g.md5[i] >> 4] << "0123456789abcdef"[g.md5[i] & 0x0f];
+   os << " " << g.paths.size() << "\n";
+   for(int i = 0; i < (int)g.paths.size(); ++i) os << g.paths[i] << "\n";
+}
+
+void freport::read(std::istream& is, header& h) throw(const char*) {
+   std::string line;
+   std::getline(is,line);
+
+   std::istringstream ls(line);
+   std::string magic;
+   int version = 0;
+   char slash = 0;
+   ls >> magic >> version >> h.shard >> slash >> h.shards >> h.opts;
+   if (!ls || magic != "#ua-report" || slash != '/') throw "Not a ua report";
+   if (version != 1) throw "Unknown report version";
+   if (h.shards < 1 || h.shard < 0 || h.shard >= h.shards) 
+      throw "Invalid shard in report";
+}
+
+static int __hex(char c) {
+   if (c >= '0' && c <= '9') return c - '0';
+   if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+   return -1;
+}
+
+bool freport::read(std::istream& is, fgroup& g) throw(const char*) {
+   std::string line;
+   if (!std::getline(is,line) || line.empty()) return false;
+
+   std::istringstream ls(line);
+   std::string tag, hex;
+   long long size = -1;
+   long n = -1;
+   ls >> tag >> size >> hex >> n;
+   if (!ls || tag != "G" || size < 0 || hex.size() != 32 || n < 0) 
+      throw "Corrupt report";
+
+   for(int i = 0; i < 16; ++i) {
+      int hi = __hex(hex[2 * i]), lo = __hex(hex[2 * i + 1]);
+      if (hi < 0 || lo < 0) throw "Corrupt report";
+      g.md5[i] = (unsigned char)(hi << 4 | lo);
+   }
+   g.size = size;
+
+   g.paths.resize(n);
+   for(long i = 0; i < n; ++i) {
+      if (!std::getline(is,g.paths[i])) throw "Truncated report";
+   }
+
+   return true;
+}
+
+void freport::produce(std::ostream& os, const fgroup& g,
+   const std::string& s, bool ph) {
+
+   if (ph) {
+      for(int i = 0; i < 16; ++i) 
+         os << "0123456789abcdef"[g.md5[i] >> 4] 
+            << "0123456789abcdef"[g.md5[i] & 0x0f];
+      os << s;
+   }
+   for(int i = 0; i < (int)g.paths.size(); ++i) {
+      if (i) os << s;
+      os << g.paths[i];
+   }
+   os << std::endl;
+}
+
+int freport::shard(off_t size, int shards) {
+   // mix the bits, sizes are far from uniformly distributed
+   uint64_t x = (uint64_t)size;
+   x ^= x >> 33;
+   x *= 0xff51afd7ed558ccdULL;
+   x ^= x >> 33;
+   x *= 0xc4ceb9fe1a85ec53ULL;
+   x ^= x >> 33;
+   return (int)(x % (uint64_t)shards);
+}
+
+fdiff::fdiff(std::istream& prev, std::ostream& os, const freport::header& h)
+throw(const char*): _prev(prev), _os(os), _live(false) {
+   _n[0] = _n[1] = _n[2] = 0;
+
+   freport::header ph;
+   freport::read(_prev,ph);
+   std::string opts = h.opts.size() ? h.opts : "-";
+   if (ph.shard != h.shard || ph.shards != h.shards || ph.opts != opts) 
+      throw "Previous report of another shard or options";
+
+   std::ostringstream hs;
+   hs << "#ua-diff 1 " << h.shard << "/" << h.shards << " " << opts << "\n";
+   _header = hs.str();
+   next();
+}
+
+void fdiff::next() throw(const char*) {
+   fgroup prev = _head;
+   bool was = _live;
+   _live = freport::read(_prev,_head);
+   if (_live && was && _head < prev) throw "Previous report not sorted";
+}
+
+void fdiff::change(const fgroup* was, const fgroup* now) {
+   static const fvec_t none;
+   const fvec_t& wp = was ? was->paths : none;
+   const fvec_t& np = now ? now->paths : none;
+
+   // the paths gained (+) and lost (-), merged in order
+   std::vector<std::pair<char,const std::string*> > ps;
+   for(size_t i = 0, j = 0; i < wp.size() || j < np.size();) {
+      if (j == np.size() || (i < wp.size() && wp[i] < np[j])) 
+         ps.push_back(std::make_pair('-',&wp[i++]));
+      else if (i == wp.size() || np[j] < wp[i]) 
+         ps.push_back(std::make_pair('+',&np[j++]));
+      else ++i, ++j;
+   }
+   if (ps.empty()) return;
+
+   int k = !was ? 0 : !now ? 1 : 2;
+   ++_n[k];
+   const fgroup& g = now ? *now : *was;
+   _os << "ADC"[k] << " " << std::dec << g.size << " ";
+   for(int i = 0; i < 16; ++i) 
+      _os << "0123456789abcdef"[g.md5[i] >> 4] 
+          << "0123456789abcdef"[g.md5[i] & 0x0f];
+   _os << " " << ps.size() << "\n";
+   for(size_t i = 0; i < ps.size(); ++i) 
+      _os << ps[i].first << *ps[i].second << "\n";
+}
+
+void fdiff::add(const fgroup& g) throw(const char*) {
+   if (_header.size()) _os << _header, _header.clear();
+   while(_live && _head < g) { // gone
+      change(&_head,0);
+      next();
+   }
+   if (_live && _head.same(g)) {
+      change(&_head,&g);
+      next();
+   } else change(0,&g);
+}
+
+void fdiff::finish() throw(const char*) {
+   if (_header.size()) _os << _header, _header.clear();
+   for(; _live; next()) change(&_head,0);
+   _os.flush();
+}
@@ -0,0 +1,211 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MERGEABLE REPORTS OF IDENTICAL FILES - HEADER
+//
+
+#if !defined(_FREPORT_H_)
+#define _FREPORT_H_
+
+#include <filei.h>
+
+#include <string>
+#include <iostream>
+
+extern "C" {
+#include <sys/types.h>
+}
+
+/** A set of identical files as stored in reports.
+ */
+struct fgroup {
+   off_t size;             // size of the files (0 if not counted)
+   unsigned char md5[16];  // the hash
+   fvec_t paths;           // the files, sorted
+
+   /** Order of groups in reports: by hash, then by size.
+    * @param g the other group
+    * @return true if this group comes first
+    */
+   bool operator<(const fgroup& g) const;
+
+   /** Whether two groups have the same key (hash and size).
+    * @param g the other group
+    * @return true if the keys are the same
+    */
+   bool same(const fgroup& g) const;
+};
+
+/** Mergeable reports.
+ *
+ * A report is a header line followed by the groups, sorted by
+ * (hash, size), each as a line
+ * <pre>
+ *    G &lt;size&gt; &lt;md5 hex&gt; &lt;number of paths&gt;
+ * </pre>
+ * and then the paths on separate lines (sorted). The header 
+ * <pre>
+ *    #ua-report 1 &lt;shard&gt;/&lt;shards&gt; &lt;options&gt;
+ * </pre>
+ * tells which shard of the files the report covers and the options
+ * (affecting the hash) it was calculated with.
+ * Because the groups are sorted, reports can be merged and compared
+ * streaming, holding only one group per report in memory.
+ */
+class freport {
+   public:
+
+      /** Report header.
+       */
+      struct header {
+         int shard;   // the shard covered
+         int shards;  // number of shards
+         std::string opts; // options affecting the hash ("-" if none)
+      };
+
+      /** Write a header.
+        * @param os output stream
+        * @param h header
+        */
+      static void write(std::ostream& os, const header& h);
+
+      /** Write a group.
+        * @param os output stream
+        * @param g group (paths sorted)
+        */
+      static void write(std::ostream& os, const fgroup& g);
+
+      /** Read a header.
+        * @param is input stream
+        * @param h header (returned)
+        * @throws a description if it is not a report
+        */
+      static void read(std::istream& is, header& h) throw(const char*);
+
+      /** Read the next group.
+        * @param is input stream
+        * @param g group (returned)
+        * @return false at the end of the report
+        * @throws a description if the report is corrupt
+        */
+      static bool read(std::istream& is, fgroup& g) throw(const char*);
+
+      /** Print a group as ua does.
+        * @param os output stream
+        * @param g group
+        * @param s separator
+        * @param ph print hash
+        */
+      static void produce(std::ostream& os, const fgroup& g,
+         const std::string& s = " ", bool ph = false);
+
+      /** Shard of a file size.
+        * @param size file size
+        * @param shards number of shards
+        * @return the shard [0,shards) the size belongs to
+        */
+      static int shard(off_t size, int shards);
+};
+
+/** Difference of a report from a previous one.
+ *
+ * The groups of the new report are given in order and the previous
+ * report is read along, one group at a time. Only the previous report is
+ * streamed: ua holds the groups of the new one in memory (with the file
+ * names it has anyway) to sort them before they are added.
+ * Only the groups that changed are written, after a header
+ * <pre>
+ *    #ua-diff 1 &lt;shard&gt;/&lt;shards&gt; &lt;options&gt;
+ * </pre>
+ * each as a line
+ * <pre>
+ *    A|D|C &lt;size&gt; &lt;md5 hex&gt; &lt;number of paths&gt;
+ * </pre>
+ * (appeared, disappeared, changed) and then the paths on separate lines,
+ * the ones gained preceded by +, the ones lost by - (sorted).
+ * Nothing is written before the first group is added, so a difference
+ * can be set up (and the previous report checked) before the new report
+ * is made.
+ */
+class fdiff {
+   private:
+      std::istream& _prev; // the previous report
+      std::ostream& _os;
+      std::string _header; // the header line, until written
+      fgroup _head;        // the next group of _prev
+      bool _live;          // whether _head is valid
+      size_t _n[3];        // groups appeared, disappeared, changed
+
+      // no copy
+      fdiff(const fdiff&);
+      fdiff& operator=(const fdiff&);
+
+      // write a change of a group (was or now 0 if it is not there)
+      void change(const fgroup* was, const fgroup* now);
+
+      // the next group of _prev
+      void next() throw(const char*);
+
+   public:
+
+      /** Constructor, reads the header of the previous report.
+        * @param prev the previous report (not owned)
+        * @param os output stream (of the difference)
+        * @param h header of the new report
+        * @throws a description if prev is not a report of the same shard
+        *         and options
+        */
+      fdiff(std::istream& prev, std::ostream& os, 
+         const freport::header& h) throw(const char*);
+
+      /** The next group of the new report.
+        * @param g group (paths sorted), not before the previous one
+        * @throws a description if the previous report is corrupt
+        */
+      void add(const fgroup& g) throw(const char*);
+
+      /** The end of the new report, the groups left in the previous one
+        * have disappeared.
+        * @throws a description if the previous report is corrupt
+        */
+      void finish() throw(const char*);
+
+      /** Groups that appeared. */
+      size_t appeared() const { return _n[0]; }
+
+      /** Groups that disappeared. */
+      size_t disappeared() const { return _n[1]; }
+
+      /** Groups that gained or lost paths. */
+      size_t changed() const { return _n[2]; }
+};
+
+#endif
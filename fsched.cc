@@ -0,0 +1,239 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// PER DEVICE JOB SCHEDULER - IMPLEMENTATION
+//
+
+#include <fsched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+}
+
+// file systems of the network
+static const char* __netfs[] = { 
+   "nfs", "nfs4", "cifs", "smb3", "smbfs", "ceph", "9p", "glusterfs",
+   "lustre", "afs", "gfs2", "ocfs2", "sshfs", "fuse.sshfs", 
+   "fuse.glusterfs", "fuse.s3fs", 0 
+};
+
+// the flag in a sysfs file (-1: none)
+static int __flag(const char* p) {
+   std::ifstream f(p);
+   int v;
+   if (!(f >> v)) return -1;
+   return v;
+}
+
+// the type of the file system of a device (from mountinfo)
+static std::string __fstype(dev_t dev) {
+   std::ifstream mi("/proc/self/mountinfo");
+   std::string line;
+   while(std::getline(mi,line)) {
+      std::istringstream ls(line);
+      std::string id, parent, mm, w;
+      if (!(ls >> id >> parent >> mm)) continue;
+      unsigned int ma, mi;
+      if (sscanf(mm.c_str(),"%u:%u",&ma,&mi) != 2 ||
+         makedev(ma,mi) != dev) continue;
+      while(ls >> w && w != "-");
+      if (ls >> w) return w;
+   }
+   return std::string();
+}
+
+fsched::fsched(const std::map<dev_t,int>& budgets, int all): 
+   _budgets(budgets), _all(all), _stop(false) {
+   pthread_mutex_init(&_m,0);
+   pthread_cond_init(&_done,0);
+}
+
+fsched::~fsched() {
+   pthread_mutex_lock(&_m);
+   _stop = true;
+   for(std::map<dev_t,device*>::iterator i = _devs.begin(); 
+      i != _devs.end(); ++i) pthread_cond_broadcast(&i->second->work);
+   pthread_mutex_unlock(&_m);
+   for(std::map<dev_t,device*>::iterator i = _devs.begin(); 
+      i != _devs.end(); ++i) {
+      device* d = i->second;
+      for(size_t w = 0; w < d->workers.size(); ++w) 
+         pthread_join(d->workers[w],0);
+      pthread_cond_destroy(&d->work);
+      delete d;
+   }
+   pthread_cond_destroy(&_done);
+   pthread_mutex_destroy(&_m);
+}
+
+void* fsched::work(void* p) {
+   device* d = static_cast<device*>(p);
+   fsched* s = d->s;
+   pthread_mutex_lock(&s->_m);
+   for(;;) {
+      while(!s->_stop && d->q.empty()) pthread_cond_wait(&d->work,&s->_m);
+      if (s->_stop) break;
+      job* j = d->q.front();
+      d->q.pop_front();
+      pthread_mutex_unlock(&s->_m);
+      j->run();
+      pthread_mutex_lock(&s->_m);
+      j->_done = true;
+      pthread_cond_broadcast(&s->_done);
+   }
+   pthread_mutex_unlock(&s->_m);
+   return 0;
+}
+
+void fsched::submit(job* j, dev_t dev) {
+   pthread_mutex_lock(&_m);
+   j->_done = false;
+   std::map<dev_t,device*>::iterator i = _devs.find(dev);
+   device* d;
+   if (i == _devs.end()) {
+      d = new device;
+      d->s = this;
+      pthread_cond_init(&d->work,0);
+      _devs[dev] = d;
+      int n = budget(dev);
+      for(int w = 0; w < n; ++w) {
+         pthread_t t;
+         if (pthread_create(&t,0,&fsched::work,d)) break;
+         d->workers.push_back(t);
+      }
+   } else d = i->second;
+   if (d->workers.empty()) { // no threads, do it here
+      pthread_mutex_unlock(&_m);
+      j->run();
+      pthread_mutex_lock(&_m);
+      j->_done = true;
+   } else {
+      d->q.push_back(j);
+      pthread_cond_signal(&d->work);
+   }
+   pthread_mutex_unlock(&_m);
+}
+
+void fsched::wait(job* j) {
+   pthread_mutex_lock(&_m);
+   while(!j->_done) pthread_cond_wait(&_done,&_m);
+   pthread_mutex_unlock(&_m);
+}
+
+bool fsched::cancel(job* j) {
+   pthread_mutex_lock(&_m);
+   bool found = false;
+   for(std::map<dev_t,device*>::iterator i = _devs.begin(); 
+      !found && i != _devs.end(); ++i) {
+      std::deque<job*>& q = i->second->q;
+      std::deque<job*>::iterator k = std::find(q.begin(),q.end(),j);
+      if (k != q.end()) q.erase(k), found = true;
+   }
+   pthread_mutex_unlock(&_m);
+   return found;
+}
+
+size_t fsched::pending() {
+   pthread_mutex_lock(&_m);
+   size_t n = 0;
+   for(std::map<dev_t,device*>::const_iterator i = _devs.begin(); 
+      i != _devs.end(); ++i) n += i->second->q.size();
+   pthread_mutex_unlock(&_m);
+   return n;
+}
+
+int fsched::budget(dev_t dev) const {
+   std::map<dev_t,int>::const_iterator i = _budgets.find(dev);
+   if (i != _budgets.end()) return i->second;
+   if (_all > 0) return _all;
+   return probe(dev);
+}
+
+fsched::kind_t fsched::kind(dev_t dev) {
+   char p[64];
+   snprintf(p,sizeof(p),"/sys/dev/block/%u:%u/queue/rotational",
+      major(dev),minor(dev));
+   int r = __flag(p);
+   if (r < 0) { // a partition, the flag is on the disk
+      snprintf(p,sizeof(p),"/sys/dev/block/%u:%u/../queue/rotational",
+         major(dev),minor(dev));
+      r = __flag(p);
+   }
+   if (r == 1) return DISK;
+   if (r == 0) return FLASH;
+   std::string fs = __fstype(dev);
+   for(const char** n = __netfs; *n; ++n) if (fs == *n) return NET;
+   return OTHER;
+}
+
+int fsched::probe(dev_t dev) {
+   switch(kind(dev)) {
+      case DISK: return __UAHDDJOBS;
+      case FLASH: return __UASSDJOBS;
+      case NET: return __UANETJOBS;
+      default: break;
+   }
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   return cpus > 0 ? static_cast<int>(cpus) : 1;
+}
+
+bool fsched::parse(const std::string& s, std::map<dev_t,int>& budgets,
+   int& all) {
+   all = 0;
+   std::istringstream is(s);
+   std::string item;
+   while(std::getline(is,item,',')) {
+      if (item.empty()) continue;
+      std::string::size_type e = item.rfind('=');
+      char* end;
+      long n = strtol(item.c_str() + (e == std::string::npos ? 0 : e + 1),
+         &end,10);
+      if (*end || n <= 0) return false;
+      if (e == std::string::npos) { all = n; continue; }
+      std::string what = item.substr(0,e);
+      unsigned int ma, mi;
+      char c;
+      struct stat st;
+      if (sscanf(what.c_str(),"%u:%u%c",&ma,&mi,&c) == 2) 
+         budgets[makedev(ma,mi)] = n;
+      else if (!::stat(what.c_str(),&st)) budgets[st.st_dev] = n;
+      else return false;
+   }
+   return true;
+}
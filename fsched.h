@@ -0,0 +1,213 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// PER DEVICE JOB SCHEDULER - HEADER
+//
+
+#if !defined(_FSCHED_H_)
+#define _FSCHED_H_
+
+// default workers of a device: rotational, non-rotational and 
+// network file system (the others get one for each CPU)
+//
+#if !defined(__UAHDDJOBS)
+#define __UAHDDJOBS 1
+#endif
+
+#if !defined(__UASSDJOBS)
+#define __UASSDJOBS 8
+#endif
+
+#if !defined(__UANETJOBS)
+#define __UANETJOBS 16
+#endif
+
+// jobs ua submits ahead of the size group it is at
+//
+#if !defined(__UASCHEDAHEAD)
+#define __UASCHEDAHEAD 1024
+#endif
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+
+extern "C" {
+#include <sys/types.h>
+#include <pthread.h>
+}
+
+/** Per device job scheduler.
+ *
+ * Jobs (reading files) are queued by the device they read from, and 
+ * each device has its own workers, as many as the device takes well:
+ * one for a spinning disk, which only seeks more when read at several
+ * places, more for flash and even more for network file systems, where
+ * the latency of the requests is what has to be overlapped. The number
+ * of workers (the budget) comes from the rotational flag in sysfs, or
+ * from the type of the file system when it is not on a block device,
+ * and can be overridden.
+ *
+ * The jobs of a device run in the order they were submitted. Workers
+ * are started when the first job of their device arrives.
+ *
+ * <pre>
+ *    fsched s;
+ *    s.submit(j,st.st_dev);
+ *    ...
+ *    s.wait(j);
+ * </pre>
+ */
+class fsched {
+
+   public:
+
+      /** A job.
+       */
+      class job {
+         private:
+            friend class fsched;
+            bool _done;
+
+         public:
+            job(): _done(false) {}
+            virtual ~job() {}
+
+            /** Do the job (in a worker thread).
+             * It should not throw.
+             */
+            virtual void run() = 0;
+      };
+
+   private:
+
+      // queue and workers of a device
+      struct device {
+         fsched* s;
+         std::deque<job*> q;
+         std::vector<pthread_t> workers;
+         pthread_cond_t work; // signalled when there is a job
+      };
+
+      std::map<dev_t,device*> _devs;
+      std::map<dev_t,int> _budgets; // overrides
+      int _all; // override for all devices (0: none)
+      bool _stop;
+
+      pthread_mutex_t _m;   // guards everything
+      pthread_cond_t _done; // signalled when a job is done
+
+      static void* work(void* d);
+
+      // no copies, the workers refer to this
+      fsched(const fsched&);
+      fsched& operator=(const fsched&);
+
+   public:
+
+      /** Constructor.
+       * @param budgets workers of some devices (overrides)
+       * @param all workers of the other devices (0: from the device)
+       */
+      fsched(const std::map<dev_t,int>& budgets = std::map<dev_t,int>(), 
+         int all = 0);
+
+      /** Destructor, stops the workers.
+       * Jobs still queued are not run.
+       */
+      ~fsched();
+
+      /** Queue a job.
+       * @param j the job (still owned by the caller)
+       * @param dev the device it reads from
+       */
+      void submit(job* j, dev_t dev);
+
+      /** Wait for a job to be done.
+       * @param j the job
+       */
+      void wait(job* j);
+
+      /** Take back a job that has not started.
+       * @param j the job
+       * @return false if it has started (wait for it)
+       */
+      bool cancel(job* j);
+
+      /** Jobs queued, not yet started.
+       * @return the number of jobs waiting on all devices
+       */
+      size_t pending();
+
+      /** Workers of a device.
+       * @param dev the device
+       * @return the budget (the override if there is one)
+       */
+      int budget(dev_t dev) const;
+
+      /** Kinds of devices.
+       */
+      enum kind_t {
+         DISK = 0, // rotational
+         FLASH,    // non-rotational
+         NET,      // network file system
+         OTHER     // no block device (eg. tmpfs)
+      };
+
+      /** What a device is.
+       * From the rotational flag in sysfs, or the type of the file 
+       * system if it is not on a block device.
+       * @param dev the device
+       * @return the kind
+       */
+      static kind_t kind(dev_t dev);
+
+      /** Workers a device takes well.
+       * @param dev the device
+       * @return the default budget
+       */
+      static int probe(dev_t dev);
+
+      /** Parse budget overrides.
+       * The format is a comma separated list of &lt;n&gt; (all devices),
+       * &lt;path&gt;=&lt;n&gt; (the device of path) or 
+       * &lt;major&gt;:&lt;minor&gt;=&lt;n&gt;.
+       * @param s the overrides
+       * @param budgets the overrides of devices (returned)
+       * @param all the override for all devices (returned, 0 if none)
+       * @return false if it cannot be parsed
+       */
+      static bool parse(const std::string& s, std::map<dev_t,int>& budgets,
+         int& all);
+};
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// PIPELINED PARALLEL STAT - IMPLEMENTATION
+//
+
+#include <fstatq.h>
+
+#include <algorithm>
+
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+}
+
+// bounded blocking queue
+// put() blocks while full, take() while empty,
+// close() ends the input (take() returns the rest),
+// abort() wakes everyone and drops everything
+template<typename T>
+class __fqueue {
+
+   private:
+      std::deque<T> _q;
+      size_t _depth;
+      bool _closed;
+      bool _aborted;
+
+      pthread_mutex_t _m;
+      pthread_cond_t _full;  // signalled when not full
+      pthread_cond_t _empty; // signalled when not empty
+
+   public:
+      __fqueue(size_t depth): _depth(depth), _closed(false), _aborted(false) {
+         ::pthread_mutex_init(&_m,0);
+         ::pthread_cond_init(&_full,0);
+         ::pthread_cond_init(&_empty,0);
+      }
+
+      ~__fqueue() {
+         ::pthread_cond_destroy(&_empty);
+         ::pthread_cond_destroy(&_full);
+         ::pthread_mutex_destroy(&_m);
+      }
+
+      // put some items, false if aborted
+      template<typename I>
+      bool put(I b, I e) {
+         ::pthread_mutex_lock(&_m);
+         while(!_aborted && _q.size() >= _depth) 
+            ::pthread_cond_wait(&_full,&_m);
+         bool ok = !_aborted;
+         if (ok) _q.insert(_q.end(),b,e);
+         ::pthread_cond_broadcast(&_empty);
+         ::pthread_mutex_unlock(&_m);
+         return ok;
+      }
+
+      // take at most n items, false if there will be no more
+      bool take(std::vector<T>& b, size_t n) {
+         b.clear();
+         ::pthread_mutex_lock(&_m);
+         while(!_aborted && !_closed && _q.empty()) 
+            ::pthread_cond_wait(&_empty,&_m);
+         if (!_aborted) {
+            n = std::min(n,_q.size());
+            b.insert(b.end(),_q.begin(),_q.begin() + n);
+            _q.erase(_q.begin(),_q.begin() + n);
+         }
+         ::pthread_cond_broadcast(&_full);
+         ::pthread_mutex_unlock(&_m);
+         return !b.empty();
+      }
+
+      size_t size() {
+         ::pthread_mutex_lock(&_m);
+         size_t n = _q.size();
+         ::pthread_mutex_unlock(&_m);
+         return n;
+      }
+
+      void close() {
+         ::pthread_mutex_lock(&_m);
+         _closed = true;
+         ::pthread_cond_broadcast(&_empty);
+         ::pthread_mutex_unlock(&_m);
+      }
+
+      void abort() {
+         ::pthread_mutex_lock(&_m);
+         _aborted = true;
+         _q.clear();
+         ::pthread_cond_broadcast(&_empty);
+         ::pthread_cond_broadcast(&_full);
+         ::pthread_mutex_unlock(&_m);
+      }
+};
+
+fstatq::fstatq(source& src, int jobs, bool st, size_t depth) 
+throw(const char*): _src(src), _st(st), 
+   _in(new __fqueue<std::string>(depth)), _out(new __fqueue<fstatr>(depth)),
+   _live(0) {
+
+   ::pthread_mutex_init(&_lm,0);
+
+   for(int i = 0; i < std::max(jobs,1); ++i) {
+      pthread_t t;
+      if (::pthread_create(&t,0,&work,this)) break;
+      _workers.push_back(t);
+   }
+   _live = _workers.size();
+
+   if (!_live || ::pthread_create(&_feeder,0,&feed,this)) {
+      _in->abort();
+      _out->abort();
+      for(int i = 0; i < (int)_workers.size(); ++i) 
+         ::pthread_join(_workers[i],0);
+      delete _in;
+      delete _out;
+      ::pthread_mutex_destroy(&_lm);
+      throw "Could not start threads";
+   }
+}
+
+fstatq::~fstatq() {
+   // wake the threads if the records were not all consumed
+   _in->abort();
+   _out->abort();
+
+   ::pthread_join(_feeder,0);
+   for(int i = 0; i < (int)_workers.size(); ++i) 
+      ::pthread_join(_workers[i],0);
+
+   delete _in;
+   delete _out;
+   ::pthread_mutex_destroy(&_lm);
+}
+
+void* fstatq::feed(void* q) {
+   fstatq& self = *static_cast<fstatq*>(q);
+
+   std::string path;
+   while(self._src.next(path)) 
+      if (!self._in->put(&path,&path + 1)) break;
+
+   self._in->close();
+   return 0;
+}
+
+void* fstatq::work(void* q) {
+   fstatq& self = *static_cast<fstatq*>(q);
+
+   std::vector<std::string> b;
+   std::vector<fstatr> r;
+   while(self._in->take(b,__UASTATBATCH)) {
+      r.resize(b.size());
+      for(int i = 0; i < (int)b.size(); ++i) {
+         r[i].path = b[i];
+         if (self._st && !self._src.known(b[i],r[i].size)) stat(b[i],r[i]);
+         else {
+            if (!self._st) r[i].size = 0;
+            r[i].dev = 0, r[i].ino = 0, r[i].error = 0;
+         }
+      }
+      if (!self._out->put(r.begin(),r.end())) break;
+   }
+
+   // the last worker ends the records
+   ::pthread_mutex_lock(&self._lm);
+   if (!--self._live) self._out->close();
+   ::pthread_mutex_unlock(&self._lm);
+   return 0;
+}
+
+size_t fstatq::pending() const {
+   return _in->size() + _out->size();
+}
+
+bool fstatq::get(fstatr& r) {
+   if (_got.empty()) {
+      std::vector<fstatr> b;
+      if (!_out->take(b,__UASTATBATCH)) return false;
+      _got.insert(_got.end(),b.begin(),b.end());
+   }
+   r = _got.front();
+   _got.pop_front();
+   return true;
+}
+
+bool fstatq::stat(const std::string& path, fstatr& r) {
+   r.error = 0;
+
+#if defined(STATX_BASIC_STATS)
+   // only ask for what is needed, network file systems may answer faster
+   struct statx x;
+   if (!::statx(AT_FDCWD,path.c_str(),0,STATX_TYPE|STATX_SIZE|STATX_INO,&x)) {
+      if (!S_ISREG(x.stx_mode)) r.error = "Not a file.";
+      r.size = x.stx_size;
+      r.dev = makedev(x.stx_dev_major,x.stx_dev_minor);
+      r.ino = x.stx_ino;
+      return !r.error;
+   } else if (errno != ENOSYS) {
+      r.error = "Could not stat file.";
+      return false;
+   }
+#endif
+
+   struct stat fsi;
+   if (::stat(path.c_str(),&fsi)) {
+      r.error = "Could not stat file.";
+      return false;
+   }
+   if (!S_ISREG(fsi.st_mode)) r.error = "Not a file.";
+   r.size = fsi.st_size;
+   r.dev = fsi.st_dev;
+   r.ino = fsi.st_ino;
+   return !r.error;
+}
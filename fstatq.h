@@ -0,0 +1,179 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// PIPELINED PARALLEL STAT - HEADER
+//
+
+#if !defined(_FSTATQ_H_)
+#define _FSTATQ_H_
+
+// number of path names a worker takes (and stats) at once
+//
+#if !defined(__UASTATBATCH)
+#define __UASTATBATCH 64
+#endif
+
+// default capacity of the queues (path names and records)
+//
+#if !defined(__UASTATDEPTH)
+#define __UASTATDEPTH 4096
+#endif
+
+#include <string>
+#include <vector>
+#include <deque>
+
+extern "C" {
+#include <sys/types.h>
+#include <pthread.h>
+}
+
+/** The status of a file, as needed for grouping.
+ */
+struct fstatr {
+   std::string path; // path name
+   off_t size;       // size in bytes
+   dev_t dev;        // device and
+   ino_t ino;        // inode (equal for hard links)
+   const char* error; // 0, or why the file was skipped
+};
+
+template<typename T> class __fqueue; // bounded blocking queue (fstatq.cc)
+
+/** Pipelined, parallel stat.
+ *
+ * A feeder thread pulls the path names from a source, a pool of workers
+ * stats them in batches (statx where available) and the records come
+ * out of get() in completion order, so the caller can start working on
+ * the first records while the rest are still being stat'ed. On network
+ * file systems the latency of the stats overlaps with each other and
+ * with whatever the caller does.
+ *
+ * Both queues are bounded: when the caller falls behind, the workers
+ * block, and then the feeder stops reading the source.
+ *
+ * <pre>
+ *    fstatq q(src,8);
+ *    fstatr r;
+ *    while(q.get(r)) ...
+ * </pre>
+ */
+class fstatq {
+
+   public:
+
+      /** Source of path names.
+       * next() is called from the feeder thread.
+       */
+      struct source {
+         virtual ~source() {}
+
+         /** Get the next path name.
+          * @param path the path name (returned)
+          * @return false at the end of the input
+          */
+         virtual bool next(std::string& path) = 0;
+
+         /** Whether the size of a file is known already, such a file is
+          * not stat'ed (its record has no device and inode).
+          * Called from the worker threads.
+          * @param path the path name
+          * @param size the size (returned)
+          * @return true if the size is known
+          */
+         virtual bool known(const std::string& /* path */, 
+            off_t& /* size */) const {
+            return false;
+         }
+      };
+
+   private:
+      source& _src; // path names
+      bool _st;     // stat or just pass the names through
+
+      __fqueue<std::string>* _in; // path names
+      __fqueue<fstatr>* _out;     // records
+
+      pthread_t _feeder;
+      std::vector<pthread_t> _workers;
+      int _live; // workers still running
+      pthread_mutex_t _lm; // guards _live
+
+      std::deque<fstatr> _got; // taken from _out, not yet returned
+
+      static void* feed(void* q);
+      static void* work(void* q);
+
+      // no copies, the threads refer to this
+      fstatq(const fstatq&);
+      fstatq& operator=(const fstatq&);
+
+   public:
+
+      /** Constructor, starts the threads.
+       *
+       * @param src source of the path names
+       * @param jobs number of stat workers
+       * @param st stat the files (if false, only size 0 records are made)
+       * @param depth capacity of the queues
+       * @throws an error message if the threads could not be started
+       */
+      fstatq(source& src, int jobs, bool st = true, 
+         size_t depth = __UASTATDEPTH) throw(const char*);
+
+      /** Destructor, stops and joins the threads.
+       */
+      ~fstatq();
+
+      /** Get the next record.
+       *
+       * Blocks until a record is available.
+       * @param r the record (returned)
+       * @return false when all path names have been processed
+       */
+      bool get(fstatr& r);
+
+      /** Queued path names and records.
+       * @return the number of entries waiting in the queues
+       */
+      size_t pending() const;
+
+      /** Stat a file.
+       *
+       * Only regular files (and symbolic links to them) are accepted.
+       * @param path path name
+       * @param r size, device and inode (returned, r.error is set)
+       * @return whether the status could be determined
+       */
+      static bool stat(const std::string& path, fstatr& r);
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MD5SUM MANIFESTS - IMPLEMENTATION
+//
+
+#include <fsums.h>
+
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <string.h>
+#include <sys/stat.h>
+}
+
+static int __hex(char c) {
+   if (c >= '0' && c <= '9') return c - '0';
+   if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+   if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+   return -1;
+}
+
+static bool __digest(const std::string& hex, unsigned char* md5) {
+   if (hex.size() != 32) return false;
+   for(int i = 0; i < 16; ++i) {
+      int hi = __hex(hex[2 * i]), lo = __hex(hex[2 * i + 1]);
+      if (hi < 0 || lo < 0) return false;
+      md5[i] = hi << 4 | lo;
+   }
+   return true;
+}
+
+// undo the escapes of md5sum (\\ and \n)
+static bool __unescape(std::string& path) {
+   std::string p;
+   for(size_t i = 0; i < path.size(); ++i) {
+      if (path[i] != '\\') { p += path[i]; continue; }
+      if (++i == path.size()) return false;
+      if (path[i] == 'n') p += '\n';
+      else if (path[i] == '\\') p += '\\';
+      else return false;
+   }
+   path.swap(p);
+   return true;
+}
+
+static struct timespec __mtime(const struct stat& st) {
+#if defined(__APPLE__)
+   return st.st_mtimespec;
+#else
+   return st.st_mtim;
+#endif
+}
+
+void fsums::load(const std::string& path) throw(const char*) {
+   std::ifstream is(path.c_str());
+   struct stat st;
+   if (!is || ::stat(path.c_str(),&st)) throw "Could not open manifest";
+
+   std::string line;
+   entry e;
+   e.stat = false;
+   while(std::getline(is,line)) {
+      if (line.empty()) continue;
+      if (line[0] == '#') {
+         std::istringstream ls(line);
+         std::string tag;
+         long long size, sec, nsec;
+         ls >> tag >> size >> sec >> nsec;
+         if (ls && tag == "#ua-stat" && size >= 0) {
+            e.stat = true;
+            e.size = size;
+            e.mtime.tv_sec = sec, e.mtime.tv_nsec = nsec;
+         }
+         continue;
+      }
+
+      bool esc = line[0] == '\\';
+      std::string p, hex;
+      if (!line.compare(esc,5,"MD5 (")) { // BSD
+         std::string::size_type k = line.rfind(") = ");
+         if (k == std::string::npos || k < esc + 5u) throw "Not an md5sum manifest";
+         p = line.substr(esc + 5,k - esc - 5);
+         hex = line.substr(k + 4);
+      } else {
+         if (line.size() < esc + 34u || line[esc + 32] != ' ' || 
+            (line[esc + 33] != ' ' && line[esc + 33] != '*')) 
+            throw "Not an md5sum manifest";
+         hex = line.substr(esc,32);
+         p = line.substr(esc + 34);
+      }
+      if (!__digest(hex,e.md5) || (esc && !__unescape(p))) 
+         throw "Not an md5sum manifest";
+      if (!e.stat) e.mtime = __mtime(st);
+      _sums[p] = e;
+      e.stat = false;
+   }
+}
+
+bool fsums::trusted(const std::string& path, unsigned char* md5) const {
+   std::map<std::string,entry>::const_iterator it = _sums.find(path);
+   struct stat st;
+   if (it == _sums.end() || ::stat(path.c_str(),&st)) return false;
+
+   const entry& e = it->second;
+   struct timespec m = __mtime(st);
+   if (e.stat) {
+      if (st.st_size != e.size || m.tv_sec != e.mtime.tv_sec || 
+         m.tv_nsec != e.mtime.tv_nsec) return false;
+   } else if (m.tv_sec > e.mtime.tv_sec || 
+      (m.tv_sec == e.mtime.tv_sec && m.tv_nsec >= e.mtime.tv_nsec)) 
+      return false; // modified since (or while) the manifest was written
+
+   ::memcpy(md5,e.md5,16);
+   return true;
+}
+
+void fsums::write(std::ostream& os, const unsigned char* md5, 
+   const std::string& path) {
+   struct stat st;
+   if (!::stat(path.c_str(),&st)) {
+      struct timespec m = __mtime(st);
+      os << "#ua-stat " << std::dec << (long long)st.st_size << " " 
+         << (long long)m.tv_sec << " " << (long long)m.tv_nsec << "\n";
+   }
+
+   bool esc = path.find_first_of("\\\n") != std::string::npos;
+   if (esc) os << '\\';
+   for(int i = 0; i < 16; ++i) 
+      os << "0123456789abcdef"[md5[i] >> 4] << "0123456789abcdef"[md5[i] & 0x0f];
+   os << "  ";
+   if (!esc) os << path;
+   else for(size_t i = 0; i < path.size(); ++i) {
+      if (path[i] == '\n') os << "\\n";
+      else if (path[i] == '\\') os << "\\\\";
+      else os << path[i];
+   }
+   os << "\n";
+}
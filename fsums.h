@@ -0,0 +1,106 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MD5SUM MANIFESTS - HEADER
+//
+
+#if !defined(_FSUMS_H_)
+#define _FSUMS_H_
+
+#include <string>
+#include <iostream>
+#include <map>
+
+extern "C" {
+#include <sys/types.h>
+#include <time.h>
+}
+
+/** md5sum manifests.
+ *
+ * A manifest is what md5sum(1) prints, one line per file
+ * <pre>
+ *    &lt;md5 hex&gt;  &lt;path&gt;
+ * </pre>
+ * (or with '*' instead of the second space, or in the BSD format
+ * "MD5 (&lt;path&gt;) = &lt;md5 hex&gt;"), a leading backslash marking a
+ * path with escaped backslashes and newlines. Lines starting with '#' are
+ * comments to md5sum -c; a comment
+ * <pre>
+ *    #ua-stat &lt;size&gt; &lt;mtime seconds&gt; &lt;nanoseconds&gt;
+ * </pre>
+ * records the stat of the file on the next line when it was hashed.
+ *
+ * The digest of a listed file is trusted if the file still has the size
+ * and modification time recorded for it, or if there is none recorded, if
+ * it was last modified before the manifest was.
+ */
+class fsums {
+   private:
+      struct entry {
+         unsigned char md5[16];
+         bool stat;       // size and mtime recorded
+         off_t size;
+         struct timespec mtime; // of the file (of the manifest if !stat)
+      };
+
+      std::map<std::string,entry> _sums;
+
+   public:
+
+      /** Load a manifest (the last one listing a file wins).
+        * @param path path name of the manifest
+        * @throws a description if it cannot be read or is not a manifest
+        */
+      void load(const std::string& path) throw(const char*);
+
+      /** Number of files listed.
+        */
+      size_t size() const { return _sums.size(); }
+
+      /** The digest of a file, if it can be trusted.
+        * @param path path name, as listed
+        * @param md5 the digest (returned)
+        * @return false if the file is not listed or has changed (or is
+        *   gone) since
+        */
+      bool trusted(const std::string& path, unsigned char* md5) const;
+
+      /** Write the line of a file (and its stat).
+        * @param os output stream
+        * @param md5 the digest
+        * @param path path name
+        */
+      static void write(std::ostream& os, const unsigned char* md5, 
+         const std::string& path);
+};
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// ARCHIVE READERS - IMPLEMENTATION
+//
+
+#include <ftar.h>
+
+#include <algorithm>
+
+extern "C" {
+#include <stdlib.h>
+#include <string.h>
+}
+
+// compressed bytes read at once
+#if !defined(__UAGZBUFF)
+#define __UAGZBUFF 65536
+#endif
+
+fgz::fgz(finput& in): _in(&in), _ib(0), _ok(false), _end(false), _eof(false) {
+   ::memset(&_z,0,sizeof(_z));
+   _ib = static_cast<char*>(::malloc(__UAGZBUFF));
+   // 32: detect gzip or zlib header
+   _ok = _ib && ::inflateInit2(&_z,15 + 32) == Z_OK;
+}
+
+fgz::~fgz() {
+   if (_ok) ::inflateEnd(&_z);
+   ::free(_ib);
+}
+
+size_t fgz::read(char* buff, size_t n) throw(const char*) {
+   _z.next_out = reinterpret_cast<Bytef*>(buff);
+   _z.avail_out = n;
+
+   while(_z.avail_out && !_end) {
+      if (!_z.avail_in) {
+         size_t k = _in->read(_ib,__UAGZBUFF);
+         if (!k) throw "Unexpected end of compressed input";
+         _z.next_in = reinterpret_cast<Bytef*>(_ib);
+         _z.avail_in = k;
+      }
+
+      int r = ::inflate(&_z,Z_NO_FLUSH);
+      if (r == Z_STREAM_END) {
+         // another gzip member may follow, after the zeros tapes and dd
+         // pad the file with (which alone are the end)
+         for(;;) {
+            while(_z.avail_in && !*_z.next_in) ++_z.next_in, --_z.avail_in;
+            if (_z.avail_in || _in->eof()) break;
+            size_t k = _in->read(_ib,__UAGZBUFF);
+            _z.next_in = reinterpret_cast<Bytef*>(_ib);
+            _z.avail_in = k;
+            if (!k) break;
+         }
+         if (_z.avail_in) ::inflateReset(&_z);
+         else _end = true;
+      } else if (r != Z_OK && r != Z_BUF_ERROR) throw "Corrupt compressed input";
+   }
+
+   size_t k = n - _z.avail_out;
+   _eof = k < n;
+   return k;
+}
+
+ftar::ftar(finput& in): _in(&in), _member(in,0), _pad(0) {
+}
+
+int ftar::kind(const std::string& path) {
+   static const char* tars[] = { ".tar", 0 };
+   static const char* tgzs[] = { ".tar.gz", ".tgz", ".tar.z", ".taz", 0 };
+
+   for(const char** s = tars; *s; ++s) {
+      size_t l = ::strlen(*s);
+      if (path.size() > l && !path.compare(path.size() - l,l,*s)) return 1;
+   }
+   for(const char** s = tgzs; *s; ++s) {
+      size_t l = ::strlen(*s);
+      if (path.size() > l && !path.compare(path.size() - l,l,*s)) return 2;
+   }
+   return 0;
+}
+
+// numeric header field: octal, or base-256 if the high bit is set
+static off_t __number(const char* p, size_t n) {
+   off_t r = 0;
+   if (*p & 0x80) {
+      r = *p & 0x3f;
+      for(size_t i = 1; i < n; ++i) r = (r << 8) | (unsigned char)p[i];
+      return r;
+   }
+   for(size_t i = 0; i < n; ++i) {
+      if (p[i] >= '0' && p[i] <= '7') r = (r << 3) | (p[i] - '0');
+      else if (p[i] != ' ' || r) break;
+   }
+   return r;
+}
+
+// a NUL terminated header field
+static std::string __field(const char* p, size_t n) {
+   return std::string(p,std::find(p,p + n,'\0'));
+}
+
+// read all of a (small) member's data
+static std::string __slurp(finput& in, off_t n) throw(const char*) {
+   if (n > (1 << 20)) throw "Corrupt archive (extended header too long)";
+   std::string s(n,'\0');
+   if (n && in.read(&s[0],n) != (size_t)n) throw "Unexpected end of archive";
+   in.skip((512 - n % 512) % 512);
+   return s;
+}
+
+bool ftar::header(char* h) throw(const char*) {
+   if (_in->read(h,512) != 512) throw "Unexpected end of archive";
+
+   unsigned sum = 0;
+   bool zero = true;
+   for(int i = 0; i < 512; ++i) {
+      if (h[i]) zero = false;
+      sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)h[i];
+   }
+   if (zero) return false; // end of archive
+   if (sum != (unsigned)__number(h + 148,8)) throw "Not a tar archive";
+   return true;
+}
+
+bool ftar::next(std::string& name, off_t& size) throw(const char*) {
+   // rest of the previous member
+   _member.skip(_member.left());
+   _in->skip(_pad);
+   _pad = 0;
+
+   std::string lname;  // GNU long name
+   std::string pname;  // pax path
+   off_t psize = -1;   // pax size
+
+   char h[512];
+   while(header(h)) {
+      char type = h[156];
+      off_t n = __number(h + 124,12);
+
+      switch(type) {
+         case 'L': // GNU long name of the next member
+            lname = __slurp(*_in,n);
+            lname = __field(lname.data(),lname.size());
+            continue;
+         case 'x': { // pax header of the next member
+            std::string x = __slurp(*_in,n);
+            for(size_t p = 0; p < x.size();) {
+               size_t sp = x.find(' ',p);
+               size_t l = ::atol(x.c_str() + p);
+               if (sp == std::string::npos || !l || p + l > x.size()) break;
+               std::string kv = x.substr(sp + 1,p + l - sp - 2);
+               if (!kv.compare(0,5,"path=")) pname = kv.substr(5);
+               else if (!kv.compare(0,5,"size=")) psize = ::atoll(kv.c_str() + 5);
+               p += l;
+            }
+            continue;
+         }
+         case '0':
+         case '\0':
+         case '7':
+            break;
+         default: // not a regular file
+            _in->skip((n + 511) / 512 * 512);
+            lname.clear(), pname.clear(), psize = -1;
+            continue;
+      }
+
+      if (psize >= 0) n = psize;
+
+      if (pname.size()) name = pname;
+      else if (lname.size()) name = lname;
+      else {
+         name = __field(h,100);
+         if (!::memcmp(h + 257,"ustar",5) && h[345]) 
+            name = __field(h + 345,155) + "/" + name;
+      }
+
+      size = n;
+      _member = fsub(*_in,n);
+      _pad = (512 - n % 512) % 512;
+      return true;
+   }
+
+   return false;
+}
@@ -0,0 +1,137 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// ARCHIVE READERS - HEADER
+//
+
+#if !defined(_FTAR_H_)
+#define _FTAR_H_
+
+#include <finput.h>
+
+extern "C" {
+#include <zlib.h>
+}
+
+/** Gzip (or zlib) decompression of another input.
+ *
+ * Concatenated gzip members are read as one stream; the zero bytes
+ * after a member (the padding of tapes and dd) are skipped.
+ */
+class fgz: public finput {
+   private:
+      finput* _in;   // compressed input (not owned)
+      z_stream _z;   // inflate state
+      char* _ib;     // compressed bytes
+      bool _ok;      // inflate initialized
+      bool _end;     // end of the decompressed stream
+      bool _eof;     // last read was short
+
+      // no copies
+      fgz(const fgz&);
+      fgz& operator=(const fgz&);
+
+   public:
+
+      /** Constructor.
+       * @param in the compressed input (not owned)
+       */
+      fgz(finput& in);
+
+      /** Destructor.
+       */
+      ~fgz();
+
+      bool good() const { return _ok && _in->good(); }
+
+      size_t read(char* buff, size_t n) throw(const char*);
+
+      bool eof() const { return _eof; }
+};
+
+/** Streaming reader of tar archives.
+ *
+ * Walks the members in one sequential pass over the input. Only 
+ * regular files are reported; directories, links, devices etc. are 
+ * skipped. Understands ustar, GNU long names and pax path/size records.
+ *
+ * <pre>
+ *    ffile f("x.tar");
+ *    ftar t(f);
+ *    std::string name;
+ *    off_t size;
+ *    while(t.next(name,size)) filei fi(name,t.member(),...);
+ * </pre>
+ */
+class ftar {
+   private:
+      finput* _in;  // the archive (not owned)
+      fsub _member; // the data of the current member
+      off_t _pad;   // padding after the current member
+
+      // read a 512 byte header block, false at the end of the archive
+      bool header(char* h) throw(const char*);
+
+      // no copies
+      ftar(const ftar&);
+      ftar& operator=(const ftar&);
+
+   public:
+
+      /** Constructor.
+       * @param in the (uncompressed) archive (not owned)
+       */
+      ftar(finput& in);
+
+      /** Advance to the next regular file.
+       *
+       * What has not been read of the previous member is skipped.
+       *
+       * @param name name of the member in the archive (returned)
+       * @param size size of the member (returned)
+       * @return false at the end of the archive
+       * @throws a description if the archive is corrupt
+       */
+      bool next(std::string& name, off_t& size) throw(const char*);
+
+      /** The data of the current member.
+        * @return input of the member's bytes
+        */
+      finput& member() { return _member; }
+
+      /** Whether a file name looks like a (compressed) tar archive.
+        * @param path file name
+        * @return 0: not an archive, 1: tar, 2: compressed tar
+        */
+      static int kind(const std::string& path);
+};
+
+#endif
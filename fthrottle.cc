@@ -0,0 +1,211 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// READ THROTTLING - IMPLEMENTATION
+//
+
+#include <fthrottle.h>
+
+#include <algorithm>
+#include <map>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+}
+
+// ioprio_set(2), glibc has no wrapper
+static const int __IOPRIO_WHO_PROCESS = 1;
+static const int __IOPRIO_CLASS_BE = 2;
+static const int __IOPRIO_CLASS_IDLE = 3;
+static const int __IOPRIO_CLASS_SHIFT = 13;
+
+// the adaptive throttle never goes below this (bytes/s)
+static const double __floor = 1 << 20;
+
+static pthread_mutex_t __m = PTHREAD_MUTEX_INITIALIZER;
+
+static double __bps = 0;    // byte limit
+static double __iops = 0;   // read limit
+static double __rate = 0;   // adaptive byte limit (0: none)
+static double __btok = 0;   // byte tokens
+static double __otok = 0;   // read tokens
+static double __last = -1;  // time of the last read (s)
+
+static double __target = 0; // adaptive target latency (ms)
+static double __next = 0;   // when to look at the devices again
+static double __period = 0; // start of the period
+static double __bytes = 0;  // bytes read in the period
+
+// device -> (I/Os, ms spent on I/O)
+typedef std::map<std::string,std::pair<double,double> > __disks_t;
+static __disks_t __disks;
+
+static double __now() {
+   struct timespec ts;
+   ::clock_gettime(CLOCK_MONOTONIC,&ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the worst latency (ms) of the devices busy since the last call
+static double __latency() {
+   std::ifstream ds("/proc/diskstats");
+   std::string line;
+   double worst = 0;
+   while(std::getline(ds,line)) {
+      std::istringstream ls(line);
+      int major, minor;
+      std::string name;
+      double rio, rmerge, rsect, rms, wio, wmerge, wsect, wms;
+      if (!(ls >> major >> minor >> name >> rio >> rmerge >> rsect >> rms 
+         >> wio >> wmerge >> wsect >> wms)) continue;
+
+      std::pair<double,double> now(rio + wio,rms + wms);
+      __disks_t::iterator it = __disks.find(name);
+      if (it != __disks.end()) {
+         double ios = now.first - it->second.first;
+         // too few I/Os say nothing
+         if (ios >= 10) worst = std::max(worst,(now.second - it->second.second) / ios);
+         it->second = now;
+      } else __disks[name] = now;
+   }
+   return worst;
+}
+
+// adjust the adaptive limit (locked)
+static void __adapt(double t) {
+   double lat = __latency();
+   double seen = t > __period ? __bytes / (t - __period) : 0;
+
+   if (__period && lat > __target) {
+      // back off: half of what was allowed (or done)
+      double r = __rate ? __rate : __bps ? std::min(__bps,seen) : seen;
+      __rate = std::max(__floor,r / 2);
+   } else if (__rate) {
+      // and come back slowly
+      __rate += std::max(__floor,__rate / 8);
+      if (__bps ? __rate >= __bps : __rate > 2 * seen) __rate = 0;
+   }
+
+   __period = t;
+   __next = t + __UATHRPERIOD / 1000.0;
+   __bytes = 0;
+}
+
+void fthrottle::limit(double bps, double iops) {
+   ::pthread_mutex_lock(&__m);
+   __bps = bps;
+   __iops = iops;
+   __last = -1;
+   ::pthread_mutex_unlock(&__m);
+}
+
+void fthrottle::adaptive(double ms) {
+   ::pthread_mutex_lock(&__m);
+   __target = ms;
+   __rate = 0;
+   __period = 0;
+   __next = 0;
+   ::pthread_mutex_unlock(&__m);
+}
+
+void fthrottle::read(size_t n) {
+   double wait = 0;
+
+   ::pthread_mutex_lock(&__m);
+
+   double t = __now();
+   if (__target && t >= __next) __adapt(t);
+   __bytes += n;
+
+   double br = __rate ? __rate : __bps;
+   if (__last < 0) { // start with full buckets
+      __btok = br / 10;
+      __otok = __iops / 10;
+      __last = t;
+   }
+   double dt = t - __last;
+   __last = t;
+
+   // the buckets may go into debt, which is waited out
+   if (br) {
+      __btok = std::min(__btok + dt * br,br / 10) - n;
+      if (__btok < 0) wait = -__btok / br;
+   }
+   if (__iops) {
+      __otok = std::min(__otok + dt * __iops,__iops / 10) - 1;
+      if (__otok < 0) wait = std::max(wait,-__otok / __iops);
+   }
+
+   ::pthread_mutex_unlock(&__m);
+
+   if (wait > 0) {
+      struct timespec ts;
+      ts.tv_sec = (time_t)wait;
+      ts.tv_nsec = (long)((wait - ts.tv_sec) * 1e9);
+      while(::nanosleep(&ts,&ts)) ;
+   }
+}
+
+bool fthrottle::parse(const std::string& s, double& bps, double& iops) {
+   const char* p = s.c_str();
+   char* e;
+   bps = ::strtod(p,&e);
+   if (e == p || bps < 0) return false;
+   switch(*e) {
+      case 'k': case 'K': bps *= 1024; ++e; break;
+      case 'm': case 'M': bps *= 1024 * 1024; ++e; break;
+      case 'g': case 'G': bps *= 1024 * 1024 * 1024; ++e; break;
+   }
+
+   iops = 0;
+   if (*e == ',') {
+      p = e + 1;
+      iops = ::strtod(p,&e);
+      if (e == p || iops < 0) return false;
+   }
+   return !*e;
+}
+
+bool fthrottle::ioprio(const std::string& s) {
+   int prio;
+   if (s == "idle") prio = __IOPRIO_CLASS_IDLE << __IOPRIO_CLASS_SHIFT;
+   else if (!s.compare(0,3,"be,") && s.size() == 4 && s[3] >= '0' && s[3] <= '7') 
+      prio = __IOPRIO_CLASS_BE << __IOPRIO_CLASS_SHIFT | (s[3] - '0');
+   else return false;
+
+   return !::syscall(SYS_ioprio_set,__IOPRIO_WHO_PROCESS,0,prio);
+}
@@ -0,0 +1,104 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// READ THROTTLING - HEADER
+//
+
+#if !defined(_FTHROTTLE_H_)
+#define _FTHROTTLE_H_
+
+// how often the adaptive throttle looks at the device latencies (ms)
+//
+#if !defined(__UATHRPERIOD)
+#define __UATHRPERIOD 1000
+#endif
+
+#include <string>
+
+/** Read throttling, for scans next to other work.
+ *
+ * fthrottle::read() is meant to be filei::_rdhook: it is called with 
+ * the number of bytes after each read from a file and sleeps as long as
+ * it takes to keep the reads under the limits. The limits are two token
+ * buckets, one for bytes and one for reads (IOPS), each holding at most
+ * a tenth of a second worth of tokens.
+ *
+ * The adaptive mode watches the latency of the block devices in 
+ * /proc/diskstats (time spent on I/O over the number of I/Os, in the 
+ * last period) and halves the byte rate whenever the latency of a busy
+ * device goes above a target, then raises it slowly again (up to the
+ * limit, if there is one).
+ *
+ * <pre>
+ *    fthrottle::limit(50 << 20,200);
+ *    filei::_rdhook = &fthrottle::read;
+ * </pre>
+ * All of it is thread safe.
+ */
+class fthrottle {
+
+   public:
+
+      /** Set the limits.
+       * @param bps bytes per second (0: no limit)
+       * @param iops reads per second (0: no limit)
+       */
+      static void limit(double bps, double iops);
+
+      /** Back off when the devices get slow.
+       * @param ms target latency in milliseconds (0: off)
+       */
+      static void adaptive(double ms);
+
+      /** Account for a read, sleep if over the limits.
+       * @param n bytes read
+       */
+      static void read(size_t n);
+
+      /** Parse a limit.
+       * The format is &lt;bytes&gt;[k|m|g][,&lt;iops&gt;], 
+       * eg. 50m or 20m,100 (0 bytes: no byte limit).
+       * @param s the limit
+       * @param bps bytes per second (returned)
+       * @param iops reads per second (returned, 0 if not given)
+       * @return false if it cannot be parsed
+       */
+      static bool parse(const std::string& s, double& bps, double& iops);
+
+      /** Set the I/O priority of the process (ioprio_set).
+       * Call before starting threads, they inherit it.
+       * @param s idle, or be,N (best effort, N in 0..7 with 0 the highest)
+       * @return false if it cannot be parsed or set
+       */
+      static bool ioprio(const std::string& s);
+};
+
+#endif
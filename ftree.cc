@@ -0,0 +1,331 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// IDENTICAL DIRECTORY TREES - IMPLEMENTATION
+//
+
+#include <ftree.h>
+#include <filei.h>
+#include <fwalk.h>
+
+#include <algorithm>
+#include <map>
+
+extern "C" {
+#include <string.h>
+#include <sys/stat.h>
+#include <openssl/md5.h>
+}
+
+// a number in a digest
+static void __num(MD5_CTX& c, long long x) {
+   unsigned char b[8];
+   for(int i = 0; i < 8; ++i, x >>= 8) b[i] = (unsigned char)(x & 0xff);
+   MD5_Update(&c,b,8);
+}
+
+// a unique token for a file that is like no other (not read)
+static void __token(int i, unsigned char* md5) {
+   MD5_CTX c;
+   MD5_Init(&c);
+   MD5_Update(&c,"u",1);
+   __num(c,i);
+   MD5_Final(md5,&c);
+}
+
+// the 16 digest characters as a key
+static std::string __key(const unsigned char* md5) {
+   return std::string((const char*)md5,16);
+}
+
+void ftree::add(const std::string& root) {
+   fwalk w(root,true);
+   std::string path;
+   struct stat st;
+
+   // the open directories of the branch (path, node)
+   std::vector<std::pair<std::string,int> > branch;
+
+   while(w.next(path,&st)) {
+      size_t pl = 0;
+      while(branch.size()) {
+         const std::string& p = branch.back().first;
+         pl = p.size() + (p[p.size() - 1] == '/' ? 0 : 1);
+         if (path.size() > pl && !path.compare(0,p.size(),p) && 
+            path[pl - 1] == '/') break;
+         branch.pop_back();
+      }
+
+      node n;
+      n.parent = branch.size() ? branch.back().second : -1;
+      n.name = n.parent < 0 ? path : path.substr(pl);
+      n.dir = S_ISDIR(st.st_mode);
+      n.depth = n.parent < 0 ? 0 : _nodes[n.parent].depth + 1;
+      n.size = n.dir ? 0 : st.st_size;
+      n.mtime = st.st_mtim.tv_sec;
+      n.mtimens = st.st_mtim.tv_nsec;
+      n.files = n.dir ? 0 : 1;
+      n.rep = -1;
+      n.hashed = false;
+      ::memset(n.md5,0,16);
+
+      int i = _nodes.size();
+      _nodes.push_back(n);
+      if (n.parent >= 0) _nodes[n.parent].kids.push_back(i);
+      if (n.dir) branch.push_back(std::make_pair(path,i));
+   }
+
+   // children are after their parents
+   for(int i = _nodes.size() - 1; i >= 0; --i) {
+      node& n = _nodes[i];
+      if (n.parent >= 0) _nodes[n.parent].files += n.files;
+      std::sort(n.kids.begin(),n.kids.end(),byname(_nodes));
+   }
+}
+
+std::string ftree::path(int i) const {
+   const node& n = _nodes[i];
+   if (n.parent < 0) return n.name;
+   std::string p = path(n.parent);
+   if (p[p.size() - 1] != '/') p += '/';
+   return p + n.name;
+}
+
+int ftree::prune() {
+   // manifests, bottom up
+   std::vector<std::string> man(_nodes.size());
+   for(int i = _nodes.size() - 1; i >= 0; --i) {
+      const node& n = _nodes[i];
+      unsigned char md5[16];
+      MD5_CTX c;
+      MD5_Init(&c);
+      if (n.dir) {
+         MD5_Update(&c,"d",1);
+         for(int k = 0; k < (int)n.kids.size(); ++k) {
+            const std::string& name = _nodes[n.kids[k]].name;
+            MD5_Update(&c,name.c_str(),name.size() + 1);
+            MD5_Update(&c,man[n.kids[k]].data(),16);
+         }
+      } else {
+         MD5_Update(&c,"f",1);
+         __num(c,n.size);
+         __num(c,n.mtime);
+         __num(c,n.mtimens);
+      }
+      MD5_Final(md5,&c);
+      man[i] = __key(md5);
+   }
+
+   // top down: the first subtree of a manifest is read,
+   // the later ones (and everything in them) are not
+   std::map<std::string,int> first;
+   std::vector<bool> pruned(_nodes.size());
+   int np = 0;
+   for(int i = 0; i < (int)_nodes.size(); ++i) {
+      node& n = _nodes[i];
+      if (n.parent >= 0 && pruned[n.parent]) { pruned[i] = true; continue; }
+      if (!n.dir || !n.files) continue;
+
+      std::map<std::string,int>::iterator it = first.find(man[i]);
+      if (it == first.end()) first[man[i]] = i;
+      else {
+         n.rep = it->second;
+         pruned[i] = true;
+         ++np;
+      }
+   }
+
+   return np;
+}
+
+void ftree::mirror(int i, int r) {
+   node& n = _nodes[i];
+   const node& m = _nodes[r];
+   ::memcpy(n.md5,m.md5,16);
+   n.hashed = m.hashed;
+   // same manifest, same names
+   for(int k = 0; k < (int)n.kids.size(); ++k) mirror(n.kids[k],m.kids[k]);
+}
+
+void ftree::digest(int i) {
+   node& n = _nodes[i];
+   if (n.hashed) return;
+
+   // a pruned subtree is a copy
+   if (n.rep >= 0) {
+      digest(n.rep);
+      mirror(i,n.rep);
+      return;
+   }
+
+   for(int k = 0; k < (int)n.kids.size(); ++k) 
+      if (_nodes[n.kids[k]].dir) digest(n.kids[k]);
+
+   MD5_CTX c;
+   MD5_Init(&c);
+   for(int k = 0; k < (int)n.kids.size(); ++k) {
+      const node& kid = _nodes[n.kids[k]];
+      MD5_Update(&c,kid.name.c_str(),kid.name.size() + 1);
+      MD5_Update(&c,kid.dir ? "d" : "f",1);
+      MD5_Update(&c,kid.md5,16);
+   }
+   MD5_Final(n.md5,&c);
+   n.hashed = true;
+}
+
+void ftree::hash(bool ic, size_t bs, bool v) {
+   std::vector<bool> pruned(_nodes.size());
+   for(int i = 0; i < (int)_nodes.size(); ++i) {
+      const node& n = _nodes[i];
+      pruned[i] = n.rep >= 0 || (n.parent >= 0 && pruned[n.parent]);
+   }
+
+   // the sizes of the files to read
+   std::vector<off_t> sizes;
+   for(int i = 0; i < (int)_nodes.size(); ++i) 
+      if (!_nodes[i].dir && !pruned[i]) sizes.push_back(_nodes[i].size);
+   std::sort(sizes.begin(),sizes.end());
+
+   // a file is read if its size is not unique, the rest get a token
+   std::vector<int> reads;
+   for(int i = 0; i < (int)_nodes.size(); ++i) {
+      node& n = _nodes[i];
+      if (n.dir || pruned[i]) continue;
+
+      std::pair<std::vector<off_t>::iterator,std::vector<off_t>::iterator> r =
+         std::equal_range(sizes.begin(),sizes.end(),n.size);
+      if (r.second - r.first > 1) {
+         reads.push_back(i);
+         continue;
+      }
+
+      __token(i,n.md5);
+   }
+
+   if (reads.size()) filei::prefetch(path(reads[0]));
+   for(int k = 0; k < (int)reads.size(); ++k) {
+      node& n = _nodes[reads[k]];
+      std::string p = path(reads[k]);
+      if (k + 1 < (int)reads.size()) filei::prefetch(path(reads[k + 1]));
+
+      try {
+         filei fi(p,ic,false,0,bs);
+         ::memcpy(n.md5,fi.md5(),16);
+         n.hashed = true;
+         if (v) std::cerr << "Processed " << p << std::endl;
+      } catch(const char* e) {
+         // like no other file
+         if (v) std::cerr << "Skipping " << p << ", " << e << std::endl;
+         __token(reads[k],n.md5);
+      }
+   }
+
+   // directories (the ones in pruned subtrees are copied)
+   for(int i = 0; i < (int)_nodes.size(); ++i) {
+      const node& n = _nodes[i];
+      if (n.dir && (!pruned[i] || n.rep >= 0)) digest(i);
+   }
+}
+
+bool ftree::inside(int i, const std::vector<bool>& marked) const {
+   for(int j = _nodes[i].parent; j >= 0; j = _nodes[j].parent) 
+      if (marked[j]) return true;
+   return false;
+}
+
+// larger subtrees first, then the ones closer to the root
+struct __bysize {
+   const std::vector<std::vector<int> >& sets;
+   const std::vector<int>& files;
+   const std::vector<int>& depth;
+   __bysize(const std::vector<std::vector<int> >& s,
+      const std::vector<int>& f, const std::vector<int>& d): 
+      sets(s), files(f), depth(d) {}
+   bool operator()(int a, int b) const {
+      int fa = files[sets[a][0]], fb = files[sets[b][0]];
+      if (fa != fb) return fa > fb;
+      return depth[sets[a][0]] < depth[sets[b][0]];
+   }
+};
+
+void ftree::produce(std::ostream& os, const std::string& s, bool ph) const {
+   // sets of identical directories and files
+   std::map<std::string,std::vector<int> > dirs, files;
+   for(int i = 0; i < (int)_nodes.size(); ++i) {
+      const node& n = _nodes[i];
+      if (!n.hashed || (n.dir && !n.files)) continue;
+      (n.dir ? dirs : files)[__key(n.md5)].push_back(i);
+   }
+
+   std::vector<std::vector<int> > sets;
+   for(std::map<std::string,std::vector<int> >::const_iterator it = 
+      dirs.begin(); it != dirs.end(); ++it) 
+      if (it->second.size() > 1) sets.push_back(it->second);
+   int nd = sets.size();
+   for(std::map<std::string,std::vector<int> >::const_iterator it = 
+      files.begin(); it != files.end(); ++it) 
+      if (it->second.size() > 1) sets.push_back(it->second);
+
+   std::vector<int> nfiles(_nodes.size()), depth(_nodes.size());
+   for(int i = 0; i < (int)_nodes.size(); ++i) {
+      nfiles[i] = _nodes[i].files;
+      depth[i] = _nodes[i].depth;
+   }
+   std::vector<int> order(nd);
+   for(int i = 0; i < nd; ++i) order[i] = i;
+   std::sort(order.begin(),order.end(),__bysize(sets,nfiles,depth));
+   for(int i = nd; i < (int)sets.size(); ++i) order.push_back(i);
+
+   std::vector<bool> printed(_nodes.size());
+   for(int o = 0; o < (int)order.size(); ++o) {
+      const std::vector<int>& set = sets[order[o]];
+
+      bool all = true;
+      for(int k = 0; all && k < (int)set.size(); ++k) 
+         all = inside(set[k],printed);
+      if (all) continue;
+
+      if (ph) {
+         const unsigned char* md5 = _nodes[set[0]].md5;
+         for(int i = 0; i < 16; ++i) 
+            os << "0123456789abcdef"[md5[i] >> 4] 
+               << "0123456789abcdef"[md5[i] & 0x0f];
+         os << s;
+      }
+      for(int k = 0; k < (int)set.size(); ++k) {
+         std::string p = path(set[k]);
+         if (_nodes[set[k]].dir && p[p.size() - 1] != '/') p += '/';
+         os << (k ? s : "") << p;
+         printed[set[k]] = true;
+      }
+      os << std::endl;
+   }
+}
@@ -0,0 +1,156 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// IDENTICAL DIRECTORY TREES - HEADER
+//
+
+#if !defined(_FTREE_H_)
+#define _FTREE_H_
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+extern "C" {
+#include <sys/types.h>
+#include <time.h>
+}
+
+/** Directory trees with Merkle digests.
+ *
+ * The trees under the roots are read into memory (one node for each
+ * directory and regular file, symbolic links are not followed) and each
+ * directory gets a digest made of the names and digests of its children,
+ * so two directories have the same digest when they have the same names
+ * with the same contents all the way down. The digest of a file is its 
+ * md5 (see filei); files whose size is unique among all the files get a 
+ * unique token instead, without being read, since no other file can be
+ * identical to them.
+ *
+ * Optionally, subtrees are pruned by their manifest, the names, sizes
+ * and modification times of everything in them: of subtrees with the 
+ * same manifest only the first is read, the others are assumed to be
+ * its copies.
+ *
+ * <pre>
+ *    ftree t;
+ *    t.add("/backup/mon");
+ *    t.add("/backup/tue");
+ *    t.hash(false,1024,false);
+ *    t.produce(std::cout);
+ * </pre>
+ */
+class ftree {
+
+   private:
+
+      struct node {
+         std::string name;    // the name (the path for roots)
+         int parent;          // -1 for roots
+         bool dir;            // directory or regular file
+         int depth;           // 0 for roots
+         off_t size;          // file size
+         time_t mtime;        // modification time (seconds 
+         long mtimens;        // and nanoseconds)
+         int files;           // number of files in the subtree
+         int rep;             // pruned: the subtree this is a copy of
+         bool hashed;         // md5 is a digest (not a token, not unset)
+         unsigned char md5[16]; // the digest
+         std::vector<int> kids; // children, sorted by name
+      };
+
+      std::vector<node> _nodes; // pre-order, parents before children
+
+      // children in name order
+      struct byname {
+         const std::vector<node>& nodes;
+         byname(const std::vector<node>& n): nodes(n) {}
+         bool operator()(int i, int j) const { 
+            return nodes[i].name < nodes[j].name; 
+         }
+      };
+
+      // copy the digests of the subtree r into the subtree i
+      void mirror(int i, int r);
+
+      // digest of a directory from its children (unless done)
+      void digest(int i);
+
+      // is i in the subtree of a node marked
+      bool inside(int i, const std::vector<bool>& marked) const;
+
+   public:
+
+      /** Read a tree.
+       * @param root a directory (or a file)
+       */
+      void add(const std::string& root);
+
+      /** Prune subtrees by their manifest.
+       * Call before hash().
+       * @return the number of subtrees pruned
+       */
+      int prune();
+
+      /** Calculate the digests.
+       * @param ic ignore case
+       * @param bs internal buffer size
+       * @param v report progress on stderr
+       */
+      void hash(bool ic, size_t bs, bool v);
+
+      /** Print the sets of identical directories and files.
+       *
+       * The sets of identical directories come first, the largest ones
+       * first, then the sets of identical files. A set is not printed 
+       * when all of its members are in directories printed already,
+       * so only the topmost identical subtrees appear. Directories end
+       * with a slash. Empty directories are not reported.
+       * @param os output stream
+       * @param s separator (default " ")
+       * @param ph print hash (if true, the first column is the hash)
+       */
+      void produce(std::ostream& os, const std::string& s = " ", 
+         bool ph = false) const;
+
+      /** Path name of a node.
+       * @param i node
+       * @return its path
+       */
+      std::string path(int i) const;
+
+      /** Number of nodes.
+       * @return the number of directories and files
+       */
+      size_t size() const { return _nodes.size(); }
+};
+
+#endif
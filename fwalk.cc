@@ -0,0 +1,94 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// RECURSIVE DIRECTORY WALKER - IMPLEMENTATION
+//
+
+#include <fwalk.h>
+
+extern "C" {
+#include <string.h>
+}
+
+fwalk::fwalk(const std::string& root, bool dirs): _dirs(dirs), _root(root) {
+   // keep "/" as it is, but don't double the separator for "dir/"
+   while(_root.size() > 1 && _root[_root.size() - 1] == '/') 
+      _root.erase(_root.size() - 1);
+}
+
+fwalk::~fwalk() {
+   for(int i = 0; i < (int)_stack.size(); ++i) ::closedir(_stack[i].first);
+}
+
+bool fwalk::next(std::string& path, struct stat* st) {
+   struct stat fsi;
+
+   if (_root.size()) { // first call
+      path.swap(_root);
+      _root.clear();
+      if (::lstat(path.c_str(),&fsi)) return next(path,st);
+      if (S_ISDIR(fsi.st_mode)) {
+         DIR* d = ::opendir(path.c_str());
+         if (d) _stack.push_back(std::make_pair(d,path));
+         if (!_dirs) return next(path,st);
+      } else if (!S_ISREG(fsi.st_mode)) return next(path,st);
+      if (st) *st = fsi;
+      return true;
+   }
+
+   while(_stack.size()) {
+      struct dirent* e = ::readdir(_stack.back().first);
+      if (!e) {
+         ::closedir(_stack.back().first);
+         _stack.pop_back();
+         continue;
+      }
+      if (!::strcmp(e->d_name,".") || !::strcmp(e->d_name,"..")) continue;
+
+      const std::string& dir = _stack.back().second;
+      path = dir;
+      if (dir[dir.size() - 1] != '/') path += '/';
+      path += e->d_name;
+
+      if (::lstat(path.c_str(),&fsi)) continue;
+
+      if (S_ISDIR(fsi.st_mode)) {
+         DIR* d = ::opendir(path.c_str());
+         if (d) _stack.push_back(std::make_pair(d,path));
+         if (!_dirs) continue;
+      } else if (!S_ISREG(fsi.st_mode)) continue;
+
+      if (st) *st = fsi;
+      return true;
+   }
+
+   return false;
+}
@@ -0,0 +1,96 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// RECURSIVE DIRECTORY WALKER - HEADER
+//
+
+#if !defined(_FWALK_H_)
+#define _FWALK_H_
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+}
+
+/** Recursive directory walker.
+ *
+ * Enumerates the regular files under a directory (depth first, in
+ * directory order). Symbolic links are not followed and unreadable
+ * directories are silently skipped. The walker is pull-style, it only
+ * keeps the open directories of the current branch, so a tree can be
+ * rescanned by constructing a new walker without having to store the
+ * path names.
+ *
+ * <pre>
+ *    fwalk w("/home");
+ *    std::string path;
+ *    struct stat st;
+ *    while(w.next(path,&st)) ...
+ * </pre>
+ */
+class fwalk {
+
+   private:
+      bool _dirs; // report directories too
+      std::vector<std::pair<DIR*,std::string> > _stack; // open directories
+      std::string _root; // the root, until it has been reported
+
+      // no copies, they would share the DIR handles
+      fwalk(const fwalk&);
+      fwalk& operator=(const fwalk&);
+
+   public:
+
+      /** Constructor.
+       *
+       * @param root the directory (or a single file) to walk
+       * @param dirs also report directories (pre-order, root included)
+       */
+      fwalk(const std::string& root, bool dirs = false);
+
+      /** Destructor, closes the open directories.
+       */
+      ~fwalk();
+
+      /** Get the next entry.
+       *
+       * @param path the path of the entry (returned)
+       * @param st if not 0, the lstat of the entry (returned)
+       * @return false when there are no more entries
+       */
+      bool next(std::string& path, struct stat* st = 0);
+};
+
+#endif
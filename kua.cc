@@ -35,7 +35,8 @@
 //
 // BUILD:
 //
-// g++ -O3 -o kua filei.cc kua.cc -I . 
+// g++ -O3 -o kua filei.cc fmd5.cc fprobe.cc finput.cc findex.cc kua.cc -I .
+//    -lcrypto -lpthread
 // 
 // $ kua -vh
 //
@@ -45,21 +46,49 @@
 #define __KUA_VERSION "1.0"
 #endif
 
+#if defined(HAVE_CONFIG_H)
+#include <config.h>
+#endif
+
+#if !defined(__KUASPILL)
+#define __KUASPILL (16 << 20)  // bytes of a target on stdin kept on the heap
+#endif
+
+#if !defined(__KUAPREFIX)
+#define __KUAPREFIX 4096  // bytes of the prefix hash of a target on stdin
+#endif
+
 #include <filei.h>
+#include <finput.h>
+#include <findex.h>
+
+#include <sstream>
 
 extern "C" {
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(HAVE_MEMFD_CREATE)
+#include <sys/mman.h>
+#endif
 }
 
 static char __help[] = 
 "kua [OPTION]... [FILE]...\n\n"
 "where OPTION is\n" 
-"  -f <file>:  file to compare to\n"
+"  -f <file>:  file to compare to (-: read it from stdin)\n"
 "  -i:         ignore case\n"
 "  -w:         ignore white space\n"
 "  -n:         do not ask the FS for file size\n"
 "  -v:         verbose output (prints stuff to stderr), verbose help\n" 
 "  -b <bsize>: set internal buffer size (default 1024)\n"
+"  -m <max>:   with -f -, bytes of the prefix hash (default 4096)\n"
+"  -S <sock>:  ask the uad daemon listening on <sock>\n"
+"  -I <index>: look up the file in an index (see ua --build-index)\n"
 "  -h:         this help (-vh more verbose help)\n"
 "  -           read file names from stdin\n";
 
@@ -69,7 +98,24 @@ static char __vhelp[] =
 "  $ kua -f f.txt `ls`\n\n"
 "looks for files identical to f.txt in the current directory, while\n\n"
 "  $ find ~ -type f | kua -f f.txt -\n\n"
-"will compare f.txt to each file under home.\n"
+"will compare f.txt to each file under home.\n\n"
+"With -S the files are not compared by kua, the uad daemon (see uad -vh)\n"
+"watching the trees is asked instead, which answers from its index:\n\n"
+"  $ kua -S /run/uad.sock -f f.txt\n\n"
+"The daemon uses its own -i, -w and -n settings and does not report\n"
+"f.txt itself.\n\n"
+"With -I only f.txt is read and looked up in an index written by\n"
+"ua --build-index; the files listed are the ones which were identical\n"
+"to f.txt when the index was built:\n\n"
+"  $ kua -I data.idx -f f.txt\n\n"
+"The hashes in the index were calculated with the -i (and --sparse or\n"
+"--tree) setting of ua; -i, -w and -n are ignored.\n\n"
+"With -f - the file is read from stdin, once: it is kept in memory (in an\n"
+"anonymous memfd when large) and only its size and the hashes of its\n"
+"first 4096 bytes (-m) and of all of it are compared, the files to\n"
+"compare it to are then given on the command line:\n\n"
+"  $ upload | kua -f - /data/*\n"
+"  $ upload | kua -I data.idx -f -\n\n"
 "Blame\n\n"
 "  istvan.hernadvolgyi@gmail.com\n\n";
 
@@ -92,16 +138,213 @@ static void __phelp(bool v) {
    std::cout.flush();
 }
 
+// the file of -f - (read from stdin)
+//
+// The bytes are read once, into memory, and beyond __KUASPILL into an
+// anonymous memfd (if there is no memfd_create, all of them into memory).
+// They are hashed as needed, the files are compared to the hashes.
+//
+class __target {
+   private:
+      std::string _mem; // the bytes, if not in _fd
+      int _fd;          // memfd (-1: in _mem)
+      off_t _size;
+
+      // no copy
+      __target(const __target&);
+      __target& operator=(const __target&);
+
+      // move the bytes to a memfd
+      void spill() throw(const char*);
+
+   public:
+
+      // read stdin
+      __target() throw(const char*);
+
+      ~__target() { if (_fd >= 0) ::close(_fd); }
+
+      // number of bytes
+      off_t size() const { return _size; }
+
+      // the hash of the bytes, as filei(path,ic,iw,m,bs) would make it
+      void md5(unsigned char* md5, bool ic, bool iw, size_t m, size_t bs) 
+      throw(const char*);
+};
+
+void __target::spill() throw(const char*) {
+#if defined(HAVE_MEMFD_CREATE)
+   if ((_fd = ::memfd_create("kua",MFD_CLOEXEC)) < 0) return;
+   for(size_t w = 0; w < _mem.size();) {
+      ssize_t k = ::write(_fd,_mem.data() + w,_mem.size() - w);
+      if (k <= 0) throw "Could not write memfd";
+      w += k;
+   }
+   std::string().swap(_mem);
+#endif
+}
+
+__target::__target() throw(const char*): _fd(-1), _size(0) {
+   char buff[65536];
+   for(;;) {
+      ssize_t n = ::read(0,buff,sizeof(buff));
+      if (n < 0) throw "Could not read stdin";
+      if (!n) break;
+      if (filei::_rdhook) (*filei::_rdhook)(n);
+      _size += n;
+      if (_fd < 0) {
+         _mem.append(buff,n);
+         if (_mem.size() > __KUASPILL) spill();
+      } else for(ssize_t w = 0; w < n;) {
+         ssize_t k = ::write(_fd,buff + w,n - w);
+         if (k <= 0) throw "Could not write memfd";
+         w += k;
+      }
+   }
+}
+
+void __target::md5(unsigned char* md5, bool ic, bool iw, size_t m, 
+   size_t bs) throw(const char*) {
+   if (_fd >= 0) { // as a file, the sparse and tree hashes apply
+      std::ostringstream path;
+      path << "/proc/self/fd/" << _fd;
+      ::memcpy(md5,filei(path.str(),ic,iw,m,bs).md5(),16);
+   } else {
+      fmem is(_mem.data(),_mem.size());
+      ::memcpy(md5,filei("-",is,ic,iw,m,bs).md5(),16);
+   }
+}
+
+// ask uad for the files identical to path
+static int __ask(const std::string& sock, const std::string& path) {
+   char rp[PATH_MAX];
+   if (!::realpath(path.c_str(),rp)) {
+      std::cerr << "Could not resolve " << path << std::endl;
+      return 1;
+   }
+
+   struct sockaddr_un addr;
+   ::memset(&addr,0,sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   ::strncpy(addr.sun_path,sock.c_str(),sizeof(addr.sun_path) - 1);
+
+   int fd = ::socket(AF_UNIX,SOCK_STREAM,0);
+   if (fd < 0 || ::connect(fd,(struct sockaddr*)&addr,sizeof(addr))) {
+      std::cerr << "Could not connect to " << sock << std::endl;
+      return 1;
+   }
+
+   std::string req = std::string("HAVE ") + rp + "\n";
+   if (::write(fd,req.data(),req.size()) != (ssize_t)req.size()) {
+      std::cerr << "Could not send request" << std::endl;
+      ::close(fd);
+      return 1;
+   }
+
+   // the answer ends with an empty line
+   std::string ans;
+   char buff[4096];
+   for(ssize_t n; ans.size() < 2 || ans.compare(ans.size() - 2,2,"\n\n");) {
+      if (ans == "\n") break;
+      if ((n = ::read(fd,buff,sizeof(buff))) <= 0) break;
+      ans.append(buff,n);
+   }
+   ::close(fd);
+
+   if (!ans.compare(0,4,"ERR ")) {
+      std::cerr << ans.substr(4,ans.find('\n') - 4) << std::endl;
+      return 1;
+   }
+   if (ans.size()) std::cout << ans.substr(0,ans.size() - 1);
+
+   return 0;
+}
+
+// look up path (or the target read from stdin) in an index
+static int __lookup(const std::string& index, const std::string& path, 
+   __target* t, size_t bs) {
+   try {
+      findex idx(index);
+      bool ic = idx.opts().find('i') != std::string::npos;
+      filei::_sparse = idx.opts().find('s') != std::string::npos;
+      if (idx.opts().find('t') != std::string::npos) 
+         filei::_tree = __UATREEJOBS;
+
+      // the size and the prefix first, most files are ruled out by them
+      off_t size = t ? t->size() : filei::fsize(path);
+      if (!idx.may(size)) return 0;
+      unsigned char pmd5[16], md5[16];
+      if (t) t->md5(pmd5,ic,false,idx.prefix(),bs);
+      else ::memcpy(pmd5,filei(path,ic,false,idx.prefix(),bs).md5(),16);
+      if (!idx.has(size,pmd5)) return 0;
+
+      fvec_t paths;
+      if (size > (off_t)idx.prefix()) {
+         if (t) t->md5(md5,ic,false,0,bs);
+         else ::memcpy(md5,filei(path,ic,false,0,bs).md5(),16);
+         idx.find(size,pmd5,md5,paths);
+      } else idx.find(size,pmd5,pmd5,paths);
+
+      for(int i = 0; i < (int)paths.size(); ++i) 
+         std::cout << paths[i] << std::endl;
+   } catch(const char* e) {
+      std::cerr << e << std::endl;
+      return 1;
+   }
+   return 0;
+}
+
+// the files identical to the target read from stdin (-f -)
+//
+// A file must have the size (unless -n or -w), then the prefix hash and
+// then the hash of the target, so only the first bytes of most files
+// are read.
+//
+static int __compare(__target& t, int n, char* const * files,
+   bool ic, bool iw, bool count, size_t pre, size_t bs, bool v) {
+
+   unsigned char pmd5[16], md5[16];
+   try {
+      t.md5(pmd5,ic,iw,pre,bs);
+      t.md5(md5,ic,iw,0,bs);
+   } catch(const char* e) {
+      std::cerr << e << std::endl;
+      return 1;
+   }
+   // the prefix is the whole
+   bool whole = count && !iw && t.size() <= (off_t)pre;
+
+   for(int i = 0; i < n; ++i) {
+      const char* file = files[i];
+      if (v) std::cerr << "Considering " << file << std::endl;
+      try {
+         if (count && t.size() != filei::fsize(file)) continue;
+         filei p(file,ic,iw,pre,bs);
+         if (::memcmp(p.md5(),pmd5,16)) continue;
+         if (!whole && ::memcmp(filei(file,ic,iw,0,bs).md5(),md5,16)) 
+            continue;
+         std::cout << file << std::endl;
+      } catch(const char* e) {
+         if (v) std::cerr << "Skipping " << file << ", " << e << std::endl;
+      }
+   }
+
+   return 0;
+}
+
 int main(int argc, char* const * argv) {
 
    
    std::string cfile;
+   std::string sock; // uad socket
+   std::string index; // -I
 
    bool ic = false; // ignore case
    bool iw = false; // ignore white space
    bool v = false; // verbose
    int BN = 1024; // buffer size
    bool count = true; // take size into account
+   size_t pre = __KUAPREFIX; // -m, the prefix hash of -f -
 
    bool comm = true; // from command line
 
@@ -111,7 +354,7 @@ int main(int argc, char* const * argv) {
    }
 
    int opt;
-   while((opt = ::getopt(argc,argv,"f:hb:viws:m:n")) != -1) {
+   while((opt = ::getopt(argc,argv,"f:hb:viws:m:nS:I:")) != -1) {
       switch(opt) {
          case 'f':
             cfile = std::string(::optarg);
@@ -135,6 +378,19 @@ int main(int argc, char* const * argv) {
          case 'n':
             count = false;
             break;
+         case 'm':
+            pre = ::atoi(::optarg);
+            if (!pre) {
+               std::cerr << "Invalid prefix size " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         case 'S':
+            sock = std::string(::optarg);
+            break;
+         case 'I':
+            index = std::string(::optarg);
+            break;
          case 'h':
             __phelp(v);
             return 0;
@@ -149,8 +405,42 @@ int main(int argc, char* const * argv) {
       return 1;
    }
 
+   __target* target = 0; // -f -
+   if (cfile == "-") {
+      if (sock.size()) {
+         std::cerr << "uad needs the path of the file (no -f - with -S)!" 
+                   << std::endl;
+         return 1;
+      }
+      if (argc > ::optind && *argv[::optind] == '-') {
+         std::cerr << "The file is on stdin, give the files to compare it "
+                   << "to on the command line (no - with -f -)!" << std::endl;
+         return 1;
+      }
+      try {
+         target = new __target();
+      } catch(const char* e) {
+         std::cerr << e << std::endl;
+         return 1;
+      }
+   }
+
+   if (sock.size()) return __ask(sock,cfile);
+   if (index.size()) {
+      int ret = __lookup(index,cfile,target,BN);
+      delete target;
+      return ret;
+   }
+
    if (count && iw) count = false;
 
+   if (target) {
+      int ret = __compare(*target,argc - ::optind,argv + ::optind,
+         ic,iw,count,pre,BN,v);
+      delete target;
+      return ret;
+   }
+
    if (argc > ::optind) { 
       if (argc >= ::optind +1 && *argv[::optind] == '-') {
          if (argc > ::optind + 1) {
@@ -0,0 +1,292 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// MERGE THE REPORTS OF ua SHARDS
+//
+// BUILD:
+//
+// g++ -O3 -o ua-merge freport.cc ua-merge.cc -I .
+//
+// $ ua-merge -vh
+//
+// will provide help on using the program
+
+#if !defined(__UA_VERSION)
+#define __UA_VERSION "1.0"
+#endif
+
+#include <freport.h>
+
+#include <fstream>
+#include <algorithm>
+
+extern "C" {
+#include <stdio.h>
+#include <unistd.h>
+#include <getopt.h>
+}
+
+static char __help[] = 
+"ua-merge [OPTION]... REPORT...\n\n"
+"where OPTION is\n" 
+"  -s <sep>:   separator (default SPACE)\n"
+"  -p:         also print the hash value\n"
+"  -r:         write a (mergeable) report instead\n"
+"  --diff-against <report>: write only the sets that appeared,\n"
+"              disappeared or changed since <report>\n"
+"  -v:         verbose output (prints stuff to stderr), verbose help\n" 
+"  -h:         this help (-vh more verbose help)\n";
+
+static char __vhelp[] =
+"ua-merge combines the reports written by ua --shard into the output ua\n"
+"would have printed had it processed all the files at once:\n\n"
+"  $ find /data -type f | ua --shard 0/2 - > s0\n"
+"  $ find /data -type f | ua --shard 1/2 - > s1\n"
+"  $ ua-merge s0 s1\n\n"
+"The reports are merged streaming (they are sorted by hash), so the\n"
+"memory used does not depend on their size. Every shard must be given\n"
+"exactly once and all must have been calculated with the same options.\n"
+"With -r, the result is again a report (of shard 0/1), which can be\n"
+"merged further. Sets with the same hash and size found in more than one\n"
+"report are united.\n\n"
+"With --diff-against, the result is compared to a previous report (of\n"
+"shard 0/1, eg. the -r output of the last run) along the merge, and only\n"
+"the sets that changed are written:\n\n"
+"  $ ua-merge --diff-against last s0 s1 > changes\n\n"
+"Each is a line A (appeared), D (disappeared) or C (changed), the size,\n"
+"the hash and the number of paths that follow, the ones gained preceded\n"
+"by +, the ones lost by -. So the work downstream is proportional to the\n"
+"changes, not to the number of files.\n\n"
+"Blame\n\n"
+"  istvan.hernadvolgyi@gmail.com\n\n";
+
+
+static void __phelp(bool v) {
+   if (v) {
+      std::cout << "Merge the reports of ua shards." << std::endl << std::endl
+                << __help << std::endl << __vhelp 
+                << "Version: " << __UA_VERSION << std::endl << std::endl;
+   } else {
+      std::cout << __help << std::endl
+                << "version: " << __UA_VERSION << std::endl << std::endl
+                << "Type ua-merge -vh for more help." << std::endl;
+   }
+   std::cout.flush();
+}
+
+// long options without a short equivalent
+static struct option __lopts[] = {
+   { "diff-against", required_argument, 0, 'd' },
+   { 0, 0, 0, 0 }
+};
+
+// the reports merged, closed on every way out of main
+class __reports {
+   private:
+      std::vector<std::ifstream*> _ins;
+
+      // no copy
+      __reports(const __reports&);
+      __reports& operator=(const __reports&);
+
+   public:
+      __reports(int n): _ins(n,(std::ifstream*)0) {}
+
+      ~__reports() {
+         for(int i = 0; i < (int)_ins.size(); ++i) delete _ins[i];
+      }
+
+      // open the i-th report
+      std::ifstream& open(int i, const char* path) {
+         delete _ins[i];
+         return *(_ins[i] = new std::ifstream(path));
+      }
+
+      std::ifstream& operator[](int i) { return *_ins[i]; }
+};
+
+// read the next group of a report, check the order
+static bool __next(std::istream& is, fgroup& head) throw(const char*) {
+   fgroup prev = head;
+   bool live = freport::read(is,head);
+   if (live && head < prev) throw "Report not sorted";
+   return live;
+}
+
+int main(int argc, char* const * argv) {
+
+   bool v = false; // verbose
+   bool ph = false; // print hash
+   bool rep = false; // write a report
+   std::string prev; // --diff-against
+
+   std::string sep(" "); // default sep
+
+   if (argc <= 1) {
+      __phelp(false);
+      return 1;
+   }
+
+   int opt;
+   while((opt = ::getopt_long(argc,argv,"hvs:pr",__lopts,0)) != -1) {
+      switch(opt) {
+         case 'v':
+            v = true;
+            break;
+         case 's':
+            sep = std::string(::optarg);
+            break;
+         case 'p':
+            ph = true;
+            break;
+         case 'r':
+            rep = true;
+            break;
+         case 'd':
+            prev = ::optarg;
+            break;
+         case 'h':
+            __phelp(v);
+            return 0;
+         case '?':
+            std::cerr << "Type " << argv[0] << " -h for options." << std::endl;
+            return 1;
+      }
+   }
+
+   int n = argc - ::optind;
+   if (n < 1) {
+      std::cerr << "No reports given. See ua-merge -vh" << std::endl;
+      return 1;
+   }
+
+   if (rep && prev.size()) {
+      std::cerr << "Either a report (-r) or a difference (--diff-against)!"
+                << std::endl;
+      return 1;
+   }
+
+   std::ifstream pin; // the previous report
+   if (prev.size() && (pin.open(prev.c_str()), !pin.good())) {
+      std::cerr << "Could not open " << prev << std::endl;
+      return 1;
+   }
+   fdiff* diff = 0;
+
+   __reports ins(n);
+   std::vector<fgroup> heads(n); // the next group of each report
+   std::vector<bool> live(n,false); // whether heads[i] is valid
+
+   freport::header mh; // header of the merged report
+   std::vector<bool> seen; // shards seen
+
+   try {
+      for(int i = 0; i < n; ++i) {
+         const char* path = argv[::optind + i];
+         if (!ins.open(i,path).good()) {
+            std::cerr << "Could not open " << path << std::endl;
+            return 1;
+         }
+
+         freport::header h;
+         freport::read(ins[i],h);
+         if (!i) {
+            mh = h;
+            seen.resize(h.shards,false);
+         } else if (h.shards != mh.shards || h.opts != mh.opts) {
+            std::cerr << path << " is not a shard of the same scan" << std::endl;
+            return 1;
+         }
+         if (seen[h.shard]) {
+            std::cerr << "Shard " << h.shard << "/" << h.shards 
+                      << " given twice" << std::endl;
+            return 1;
+         }
+         seen[h.shard] = true;
+         if (v) std::cerr << "Merging " << path << ", shard " << h.shard 
+                          << "/" << h.shards << std::endl;
+
+         live[i] = freport::read(ins[i],heads[i]);
+      }
+
+      if (std::count(seen.begin(),seen.end(),false)) {
+         std::cerr << "Missing shards:";
+         for(int i = 0; i < (int)seen.size(); ++i) 
+            if (!seen[i]) std::cerr << " " << i << "/" << mh.shards;
+         std::cerr << std::endl;
+         return 1;
+      }
+
+      mh.shard = 0, mh.shards = 1;
+      if (rep) freport::write(std::cout,mh);
+      if (prev.size()) diff = new fdiff(pin,std::cout,mh);
+
+      // k-way merge
+      for(;;) {
+         int m = -1;
+         for(int i = 0; i < n; ++i) 
+            if (live[i] && (m < 0 || heads[i] < heads[m])) m = i;
+         if (m < 0) break;
+
+         fgroup g = heads[m];
+         live[m] = __next(ins[m],heads[m]);
+         for(int i = 0; i < n; ++i) {
+            while(live[i] && heads[i].same(g)) {
+               g.paths.insert(g.paths.end(),
+                  heads[i].paths.begin(),heads[i].paths.end());
+               live[i] = __next(ins[i],heads[i]);
+            }
+         }
+         std::sort(g.paths.begin(),g.paths.end());
+         g.paths.erase(std::unique(g.paths.begin(),g.paths.end()),
+            g.paths.end());
+
+         if (rep) freport::write(std::cout,g);
+         else if (diff) diff->add(g);
+         else freport::produce(std::cout,g,sep,ph);
+      }
+
+      if (diff) {
+         diff->finish();
+         if (v) std::cerr << diff->appeared() << " sets appeared, " 
+                          << diff->disappeared() << " disappeared, "
+                          << diff->changed() << " changed" << std::endl;
+      }
+   } catch(const char* e) {
+      std::cerr << e << std::endl;
+      delete diff;
+      return 1;
+   }
+
+   delete diff;
+
+   return 0;
+}
@@ -34,14 +34,15 @@
 // THE NAME ua COMES FROM UgyanAz (HUNGARIAN FOR SAME)
 //
 // BUILD:
-// THIS TOOL REQUIRES THE OPENSSL C LIBRARIES (libcrypto).
+// THIS TOOL REQUIRES THE OPENSSL C LIBRARIES (libcrypto), zlib AND pthreads.
 //
-// g++ -O3 -o ua filei.cc ua.cc -I . -lcrypto
-// 
-// or
+// ./configure && make   (see Makefile.am), or by hand
 //
-// g++ -O3 -o ua filei.cc ua.cc -I . -D__NOHASH -lcrypto
-// if you prefer to use tree based containers.
+// g++ -O3 -o ua filei.cc fmd5.cc fprobe.cc finput.cc ftar.cc freport.cc
+//    fstatq.cc findex.cc fwalk.cc ftree.cc fthrottle.cc fsched.cc
+//    fprogress.cc fsums.cc fjournal.cc ua.cc -I . -lcrypto -lz -lpthread
+// 
+// add -D__NOHASH if you prefer to use tree based containers.
 //
 // once compiled,
 //
@@ -53,10 +54,53 @@
 #define __UA_VERSION "1.0"
 #endif
 
+// files up to this size are compared by their bytes, not hashed
+//
+#if !defined(__UASMALLFILE)
+#define __UASMALLFILE 4096
+#endif
+
+// bytes of small files held at once (a larger size group is done in parts)
+//
+#if !defined(__UASMALLARENA)
+#define __UASMALLARENA (64 << 20)
+#endif
+
+// files hashed at once with a time budget (it is checked between them)
+//
+#if !defined(__UAHASHSLICE)
+#define __UAHASHSLICE 64
+#endif
+
 #include <filei.h>
+#include <ftar.h>
+#include <freport.h>
+#include <fstatq.h>
+#include <findex.h>
+#include <fwalk.h>
+#include <ftree.h>
+#include <fthrottle.h>
+#include <fsched.h>
+#include <fprogress.h>
+#include <fprobe.h>
+#include <fsums.h>
+#include <fjournal.h>
+
+#include <algorithm>
+#include <utility>
+#include <fstream>
+#include <sstream>
+#include <deque>
+#include <set>
 
 extern "C" {
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/stat.h>
 }
 
 static char __help[] = 
@@ -70,8 +114,60 @@ static char __help[] =
 "  -2:         perform two stage hashing\n"
 "  -s <sep>:   separator (default SPACE)\n"
 "  -p:         also print the hash value\n"
+"  --variants: read each file once and print the sets as they are, with\n"
+"              -i, with -w and with -i -w (each under a #ua-variant line)\n"
+"  --md5sum:   print the sets as md5sum lines (a manifest for\n"
+"              --trust-manifest and md5sum -c)\n"
+"  --trust-manifest <file>: take the hashes of the files listed in the\n"
+"              md5sum manifest <file> unless they have changed since\n"
 "  -b <bsize>: set internal buffer size (default 1024)\n"
+"  -a:         also compare the files inside tar archives\n"
+"  -l <list>:  read file names from <list> (one per line)\n"
+"  -r <dir>:   compare the files under <dir> (recursively)\n"
+"  --left <dir> --right <dir>: only the sets with files under both\n"
+"              (repeatable, instead of files, -l and -r)\n"
+"  -j <jobs>:  stat with <jobs> threads and hash while stat'ing\n"
 "  -h:         this help (-vh more verbose help)\n"
+"  --nocache:  do not keep the scanned files in the page cache\n"
+"  --direct:   read with O_DIRECT (bypass the page cache)\n"
+"  --max-read-rate <bytes>[k|m|g][,<iops>]: limit the reads per second\n"
+"  --adaptive[=<ms>]: slow down when the disk latency goes above <ms>\n"
+"              (default 20)\n"
+"  --ioprio idle|be,<n>: set the I/O priority (see ionice)\n"
+"  --progress[=<file>]: show files, bytes, rate and ETA every second on\n"
+"              stderr (or in <file>), also dumped on SIGUSR1\n"
+"  --auto:     choose -2, -m and -b from the sizes and the device (-v\n"
+"              prints the plan)\n"
+"  --payoff:   compare the size groups that may free the most bytes per\n"
+"              second of reading first\n"
+"  --time-budget <s>[m|h], --byte-budget <bytes>[k|m|g]: stop after this\n"
+"              time (or this much read) with the sets found so far\n"
+"              (implies --payoff)\n"
+"  --ignore-known <index>: leave out the files the index (--build-index)\n"
+"              has, no file of a size it has not is read in full\n"
+"  --journal <dir>: log the stats and the hashes in <dir>, to --resume\n"
+"              the scan if it is interrupted\n"
+"  --resume:   with --journal, take what the journal holds and go on\n"
+"  --latency[=<n>]: print latency histograms of opens, reads and hashes\n"
+"              and the <n> slowest files (default 10) to stderr at exit\n"
+"  --io-jobs[=<n>|<path>=<n>|<major>:<minor>=<n>,...]: hash the files of\n"
+"              each device with its own workers (default: 1 for a disk,\n"
+"              8 for flash, 16 for network file systems)\n"
+"  --sparse:   do not read the holes of sparse files\n"
+"  --tree[=<threads>]: hash the chunks of large files concurrently\n"
+"              (default 4 threads)\n"
+"  --dirs:     compare the trees under -r, report identical directories\n"
+"  --manifest: with --dirs, read only one of the subtrees with the same\n"
+"              names, sizes and modification times\n"
+"  --lowmem[=<mb>]: count the sizes first (in <mb> MB, default 16) and\n"
+"              keep only the files of repeated sizes (not with stdin)\n"
+"  --build-index <out>: write the hashes of the files to the index <out>\n"
+"              for kua -I (no sets are printed)\n"
+"  --shard <i>/<n>: only the files whose size falls into shard i of n,\n"
+"              write a mergeable report (see ua-merge)\n"
+"  --report:   write the report of all the files (--shard 0/1)\n"
+"  --diff-against <report>: write only the sets that appeared,\n"
+"              disappeared or changed since <report> (of the same shard)\n"
 "  -           read file names from stdin\n";
 
 static char __vhelp[] =
@@ -88,6 +184,73 @@ static char __vhelp[] =
 "This can be much faster when there are many files with the same size\n"
 "or when comparing files with whitespaces ignored. When -w and -m are\n"
 "both set, <max> refers to the first <max> non-white characters.\n\n"
+"With -a, the names ending in .tar, .tar.gz or .tgz are read as archives\n"
+"and their members are compared instead (along with the other files).\n"
+"Each archive is read once: the size and hash of the members are\n"
+"calculated while streaming through it, without extracting anything.\n"
+"Members are printed as <archive>:<member>. The size groups containing\n"
+"members are always fully hashed.\n\n"
+"--shard splits one scan among n processes (or machines): the files are\n"
+"assigned to shards by their size, so no set of identical files spans\n"
+"two shards. Each shard writes its sets sorted by hash in the mergeable\n"
+"report format and ua-merge combines the reports to the usual output:\n\n"
+"  $ find /data -type f | ua --shard 0/2 - > s0\n"
+"  $ find /data -type f | ua --shard 1/2 - > s1\n"
+"  $ ua-merge s0 s1\n\n"
+"With --sparse, holes are skipped (SEEK_DATA/SEEK_HOLE) instead of read.\n"
+"Runs of zero blocks are hashed by their position and length, so a sparse\n"
+"file and its non-sparse copy have the same hash, but -p will not print\n"
+"what md5sum would.\n\n"
+"With -j (--stat-jobs), a pool of threads stats the files and the size\n"
+"groups are hashed as soon as they have two members, while the rest of\n"
+"the files are still stat'ed. This pays off when stat is slow (eg. NFS).\n"
+"The files of a group are then always hashed (never compared as a pair)\n"
+"and hard links of a hashed file are not read again. The order of the\n"
+"names within an output line may vary from run to run.\n\n"
+"-l and -r can be given more than once and combined with file names.\n"
+"With -r, symbolic links are not followed.\n\n"
+"By default the names of all files are kept in memory until they are\n"
+"grouped by size, although most sizes are usually unique. --lowmem\n"
+"reads the inputs twice: the first pass only counts the sizes in a\n"
+"fixed size sketch, the second keeps the names of the files whose size\n"
+"was seen at least twice. The memory then depends on the number of\n"
+"possible duplicates instead of the number of files. It requires inputs\n"
+"that can be read twice (file names, -l or -r, but not stdin):\n\n"
+"  $ ua --lowmem -r /data\n\n"
+"With --dirs, the directories under the -r trees are compared as well:\n"
+"the digest of a directory is made of the names and digests of its\n"
+"children, and the sets of identical directories are printed first (the\n"
+"largest first, with a trailing /), then the sets of identical files.\n"
+"A set is left out when all of its members are inside directories\n"
+"printed already, so two identical snapshots make a single line:\n\n"
+"  $ ua --dirs -r /backup/mon -r /backup/tue\n\n"
+"Files of a unique size are not read. With --manifest, of the subtrees\n"
+"having the same names, sizes and modification times, only the first is\n"
+"read and the others are taken to be its copies (fast for snapshots,\n"
+"but a change which keeps the size and the time goes unnoticed).\n\n"
+"--build-index hashes every file (and the prefix of it) and writes a\n"
+"memory mapped index, which lets kua -I tell whether a file is already\n"
+"among them without reading any of them:\n\n"
+"  $ find /data -type f | ua -j8 --build-index data.idx -\n"
+"  $ kua -I data.idx -f upload.bin\n\n"
+"With --tree, files larger than 64MB are hashed in 64MB chunks, read and\n"
+"hashed by several threads at once, and the hash of such a file is the\n"
+"hash of the hashes of its chunks (and its length). This lets a set of\n"
+"huge files be hashed at the speed of the device instead of the speed\n"
+"of one md5 thread. Such files are always hashed, never compared as a\n"
+"pair, and -p does not print their md5. --sparse takes precedence.\n\n"
+"--max-read-rate, --adaptive and --ioprio bound the interference of a\n"
+"scan with the other users of the disks, at the expense of the scan time.\n"
+"--max-read-rate limits the bytes (and with ,<iops> the reads) per\n"
+"second. --adaptive watches the latency of the disks in /proc/diskstats\n"
+"and halves the rate of the scan whenever it goes above <ms>, then raises\n"
+"it slowly again (up to --max-read-rate, if given):\n\n"
+"  $ ua --ioprio idle --max-read-rate 50m,200 --adaptive -r /srv\n\n"
+"--nocache and --direct let a scan run next to other services without\n"
+"evicting their working set. --nocache reads through the page cache but\n"
+"drops what was read behind itself and reads ahead the next file, --direct\n"
+"bypasses the cache (on file systems that refuse O_DIRECT it behaves like\n"
+"--nocache).\n\n"
 "The program returns (to the shell) 0 on success and 1 otherwise.\n\n"
 "Files that cannot be processed are simply skipped (-v reports these).\n\n"
 "Examples.\n\n"
@@ -118,6 +281,9 @@ static char __vhelp[] =
 "      -2m256:     lots of files, many of the same size\n"
 "      -2nm256:    files of the same size, or comparing files with white\n"
 "                  spaces ignored\n\n"
+"    --auto makes the choice (between the first two) after the files\n"
+"    are stat'ed: it samples the prefixes of some size groups and\n"
+"    estimates the seeks and bytes read of each plan on the device.\n\n"
 "  Find identical header files.\n\n"
 "    $ find /usr/include -name '*.h' | ua -b256 -wm256 -2s, -\n\n"
 "    Ignore white spaces -w (and thus use a smaller buffer -b256). Perform\n"
@@ -161,165 +327,1881 @@ static void __phelp(bool v) {
    std::cout.flush();
 }
 
-int main(int argc, char* const * argv) {
+// long options without a short equivalent
+enum {
+   OPT_NOCACHE = 256,
+   OPT_DIRECT,
+   OPT_SHARD,
+   OPT_SPARSE,
+   OPT_INDEX,
+   OPT_LOWMEM,
+   OPT_TREE,
+   OPT_DIRS,
+   OPT_MANIFEST,
+   OPT_RATE,
+   OPT_ADAPTIVE,
+   OPT_IOPRIO,
+   OPT_IOJOBS,
+   OPT_PROGRESS,
+   OPT_AUTO,
+   OPT_LEFT,
+   OPT_RIGHT,
+   OPT_LATENCY,
+   OPT_MD5SUM,
+   OPT_TRUST,
+   OPT_PAYOFF,
+   OPT_TBUDGET,
+   OPT_BBUDGET,
+   OPT_JOURNAL,
+   OPT_RESUME,
+   OPT_IGNORE,
+   OPT_VARIANTS,
+   OPT_REPORT,
+   OPT_DIFF
+};
 
-   
-   fsetc_t files;
+static struct option __lopts[] = {
+   { "nocache", no_argument, 0, OPT_NOCACHE },
+   { "direct", no_argument, 0, OPT_DIRECT },
+   { "shard", required_argument, 0, OPT_SHARD },
+   { "sparse", no_argument, 0, OPT_SPARSE },
+   { "stat-jobs", required_argument, 0, 'j' },
+   { "build-index", required_argument, 0, OPT_INDEX },
+   { "lowmem", optional_argument, 0, OPT_LOWMEM },
+   { "tree", optional_argument, 0, OPT_TREE },
+   { "dirs", no_argument, 0, OPT_DIRS },
+   { "manifest", no_argument, 0, OPT_MANIFEST },
+   { "max-read-rate", required_argument, 0, OPT_RATE },
+   { "adaptive", optional_argument, 0, OPT_ADAPTIVE },
+   { "ioprio", required_argument, 0, OPT_IOPRIO },
+   { "io-jobs", optional_argument, 0, OPT_IOJOBS },
+   { "progress", optional_argument, 0, OPT_PROGRESS },
+   { "auto", no_argument, 0, OPT_AUTO },
+   { "left", required_argument, 0, OPT_LEFT },
+   { "right", required_argument, 0, OPT_RIGHT },
+   { "latency", optional_argument, 0, OPT_LATENCY },
+   { "md5sum", no_argument, 0, OPT_MD5SUM },
+   { "trust-manifest", required_argument, 0, OPT_TRUST },
+   { "payoff", no_argument, 0, OPT_PAYOFF },
+   { "time-budget", required_argument, 0, OPT_TBUDGET },
+   { "byte-budget", required_argument, 0, OPT_BBUDGET },
+   { "journal", required_argument, 0, OPT_JOURNAL },
+   { "resume", no_argument, 0, OPT_RESUME },
+   { "ignore-known", required_argument, 0, OPT_IGNORE },
+   { "variants", no_argument, 0, OPT_VARIANTS },
+   { "report", no_argument, 0, OPT_REPORT },
+   { "diff-against", required_argument, 0, OPT_DIFF },
+   { 0, 0, 0, 0 }
+};
 
-   bool ic = false; // ignore case
-   bool iw = false; // ignore white space
-   bool v = false; // verbose
-   bool stage = false; // two stage
-   int BN = 1024; // buffer size
-   bool ph = false; // print hash
-   bool count = true; // take size into account
+// path names from the command line or from stdin,
+// then from the lists (-l) and the trees (-r)
+class __names: public fstatq::source {
+   private:
+      int _i;
+      int _argc;
+      char* const * _argv;
+      bool _comm; // from command line
 
-   int max = 0; // max chars to consider, ALL
+      const fvec_t& _lists;
+      const fvec_t& _roots;
+      int _l, _r; // next list and tree
+      std::ifstream* _ls; // current list
+      fwalk* _w; // current tree
 
-   bool comm = true; // from command line
+   public:
+      __names(int i, int argc, char* const * argv, bool comm,
+         const fvec_t& lists, const fvec_t& roots):
+         _i(i), _argc(argc), _argv(argv), _comm(comm), 
+         _lists(lists), _roots(roots), _l(0), _r(0), _ls(0), _w(0) {
+      }
 
-   std::string sep(" "); // default sep
+      ~__names() {
+         delete _ls;
+         delete _w;
+      }
 
-   if (argc <= 1) {
-      __phelp(false);
-      return 1;
+      bool next(std::string& path) {
+         if (_comm) {
+            if (_i < _argc) {
+               path = _argv[_i++];
+               return true;
+            }
+         } else if (!std::cin.eof()) {
+            char fileb[1024];
+            std::cin.getline(fileb,1024);
+            if (!std::cin.eof()) {
+               path = fileb;
+               return true;
+            }
+         }
+
+         while(_ls || _l < (int)_lists.size()) {
+            if (!_ls) _ls = new std::ifstream(_lists[_l++].c_str());
+            if (std::getline(*_ls,path)) return true;
+            delete _ls;
+            _ls = 0;
+         }
+
+         while(_w || _r < (int)_roots.size()) {
+            if (!_w) _w = new fwalk(_roots[_r++]);
+            if (_w->next(path)) return true;
+            delete _w;
+            _w = 0;
+         }
+
+         return false;
+      }
+};
+
+// the names of the files stat'ed before a run resumed (--resume)
+class __replay: public fstatq::source {
+   private:
+      const fjournal* _jr;
+      size_t _i;
+
+   public:
+      __replay(const fjournal* jr): _jr(jr), _i(0) {}
+
+      bool next(std::string& path) {
+         if (!_jr || _i >= _jr->files().size()) return false;
+         path = _jr->files()[_i++];
+         return true;
+      }
+};
+
+// the path names of a scan with a journal (not all stat'ed): the sizes
+// in the journal are not stat'ed again by the stat pipeline (-j)
+class __journaled: public fstatq::source {
+   private:
+      fstatq::source& _src;
+      const fjournal* _jr; // read only while the scan runs
+
+   public:
+      __journaled(fstatq::source& src, const fjournal* jr): 
+         _src(src), _jr(jr) {}
+
+      bool next(std::string& path) { return _src.next(path); }
+
+      bool known(const std::string& path, off_t& size) const {
+         size_t s;
+         if (!_jr || !_jr->size(path,s)) return false;
+         size = s;
+         return true;
+      }
+};
+
+// sizes seen so far (--lowmem)
+// a count-min sketch of 2 bit counters (saturating at 2) in a single
+// array with __HASHES indices per size and conservative update: 
+// twice() may be true for a size seen once, but never false for a
+// size seen twice
+class __sketch {
+   private:
+      enum { __HASHES = 3 };
+
+      std::vector<unsigned char> _c; // four counters a byte
+      size_t _mask; // number of counters - 1
+
+      unsigned get(size_t i) const { return _c[i >> 2] >> ((i & 3) << 1) & 3; }
+
+      void set(size_t i, unsigned v) {
+         unsigned char& c = _c[i >> 2];
+         c = (c & ~(3 << ((i & 3) << 1))) | v << ((i & 3) << 1);
+      }
+
+      // the counters of a size
+      void slots(size_t s, size_t* is) const {
+         unsigned long long h = s * 0x9e3779b97f4a7c15ULL;
+         h ^= h >> 32;
+         h *= 0xd6e8feb86659fd93ULL;
+         h ^= h >> 32;
+         size_t h1 = h, h2 = (h >> 32 | h << 32) | 1;
+         for(int k = 0; k < __HASHES; ++k) is[k] = (h1 + k * h2) & _mask;
+      }
+
+   public:
+      // bytes is rounded down to a power of two
+      __sketch(size_t bytes) {
+         size_t n = 1;
+         while(n * 2 <= bytes) n *= 2;
+         _c.resize(n);
+         _mask = n * 4 - 1;
+      }
+
+      void add(size_t s) {
+         size_t is[__HASHES];
+         slots(s,is);
+         unsigned m = 2;
+         for(int k = 0; k < __HASHES; ++k) m = std::min(m,get(is[k]));
+         if (m == 2) return;
+         for(int k = 0; k < __HASHES; ++k) 
+            if (get(is[k]) == m) set(is[k],m + 1);
+      }
+
+      bool twice(size_t s) const {
+         size_t is[__HASHES];
+         slots(s,is);
+         for(int k = 0; k < __HASHES; ++k) if (get(is[k]) < 2) return false;
+         return true;
+      }
+};
+
+// first pass of --lowmem: count the sizes
+static void __count(__sketch& sizes, fstatq::source& names, int jobs)
+throw(const char*) {
+   if (jobs) {
+      fstatq sq(names,jobs);
+      fstatr r;
+      while(sq.get(r)) if (!r.error) sizes.add(r.size);
+      return;
+   }
+
+   std::string file;
+   while(names.next(file)) {
+      try {
+         sizes.add(filei::fsize(file));
+      } catch(const char*) { // reported in the second pass
+      }
+   }
+}
+
+// inode of a file (dev, ino)
+typedef std::pair<dev_t,ino_t> inode_t;
+
+// md5 of the inodes hashed so far
+typedef std::map<inode_t,std::string> inodes_t;
+
+// size groups hashed while the files are still stat'ed
+typedef std::map<size_t,fset_t> eager_t;
+
+// hash a file of a size group right away,
+// a hard link of an inode already hashed is not read again
+static void __eager(fset_t& cands, const std::string& path, 
+   const inode_t& in, inodes_t& inodes, 
+   bool ic, bool iw, size_t m, size_t bs, bool v) {
+
+   inodes_t::const_iterator it = in.second ? inodes.find(in) : inodes.end();
+   try {
+      if (it != inodes.end()) {
+         cands.add(filei(path,(const unsigned char*)it->second.data()));
+      } else {
+         filei fi(path,ic,iw,m,bs);
+         cands.add(fi);
+         if (in.second) 
+            inodes[in] = std::string((const char*)fi.md5(),16);
+      }
+      if (v) std::cerr << "Processed " << path << std::endl;
+   } catch(const char* e) {
+      if (v) std::cerr << "Skipping " << path << ", " << e << std::endl;
+   }
+}
+
+// hash a file for the index: its prefix and, if longer, all of it
+static void __entry(std::vector<findex::entry>& es, const std::string& path,
+   off_t size, bool ic, size_t bs) throw(const char*) {
+
+   findex::entry e;
+   filei p(path,ic,false,__UAIDXPREFIX,bs);
+   e.size = size;
+   e.path = path;
+   ::memcpy(e.pmd5,p.md5(),16);
+   if (size > __UAIDXPREFIX) {
+      filei f(path,ic,false,0,bs);
+      ::memcpy(e.md5,f.md5(),16);
+   } else ::memcpy(e.md5,p.md5(),16);
+   es.push_back(e);
+}
+
+// compare trees (--dirs)
+static int __dirs(const fvec_t& roots, bool manifest, bool ic, size_t bs,
+   const std::string& sep, bool ph, bool v) {
+
+   ftree t;
+   for(int i = 0; i < (int)roots.size(); ++i) t.add(roots[i]);
+   if (v) std::cerr << "Read " << t.size() << " entries" << std::endl;
+
+   if (manifest) {
+      int np = t.prune();
+      if (v) std::cerr << "Pruned " << np << " subtrees" << std::endl;
+   }
+
+   t.hash(ic,bs,v);
+   t.produce(std::cout,sep,ph);
+   return 0;
+}
+
+// the sets as they are, with -i, -w and -i -w (--variants)
+//
+// Every file is read once, into the four hashes of filei::variants. The
+// sizes are not looked at: without white spaces, files of any size may be
+// identical.
+//
+static int __variants(fstatq::source& names, size_t m, size_t bs,
+   const std::string& sep, bool ph, bool v) {
+
+   static const char* heads[4] = { "raw", "-i", "-w", "-i -w" };
+   fset_t sets[4] = { 
+      fset_t(false,false,m,bs), fset_t(true,false,m,bs), 
+      fset_t(false,true,m,bs), fset_t(true,true,m,bs) 
+   };
+
+   std::string file;
+   while(names.next(file)) {
+      std::vector<filei> fis;
+      try {
+         filei::variants(file,m,bs,fis);
+      } catch(const char* e) {
+         if (v) std::cerr << "Skipping " << file << ", " << e << std::endl;
+         continue;
+      }
+      for(int k = 0; k < 4; ++k) sets[k].add(fis[k]);
+      fprogress::done(fprogress::HASH,1,0);
+      if (v) std::cerr << "Processed " << file << std::endl;
+   }
+
+   for(int k = 0; k < 4; ++k) {
+      std::cout << "#ua-variant " << heads[k] << std::endl;
+      fset_t::produce(sets[k].common(),std::cout,sep,ph);
+   }
+   return 0;
+}
+
+// options affecting the hash, for reports and indexes
+static std::string __opts(bool ic) {
+   std::string opts;
+   if (ic) opts += "i";
+   if (filei::_sparse) opts += "s";
+   else if (filei::_tree) opts += "t";
+   return opts;
+}
+
+// hash the members of an archive in a single pass,
+// they join the size groups with the files
+static void __members(const std::string& path, fsetc_t& files, fsetk_t& known,
+   bool count, bool ic, bool iw, size_t m, size_t bs, bool v) 
+throw(const char*) {
+
+   ffile f(path);
+   if (!f.good()) throw "Could not open file";
+
+   fgz* z = 0;
+   if (ftar::kind(path) == 2) {
+      z = new fgz(f);
+      if (!z->good()) { delete z; throw "Could not init decompression"; }
+   }
+
+   try {
+      ftar t(z ? (finput&)*z : (finput&)f);
+      std::string name;
+      off_t size;
+      while(t.next(name,size)) {
+         filei fi(path + ":" + name,t.member(),ic,iw,m,bs);
+         size_t s = count ? size : 0;
+         known[s].push_back(fi);
+         files[s]; // the size group has members
+         if (v) std::cerr << "Processed " << fi.path() << std::endl;
+      }
+   } catch(const char* e) {
+      delete z;
+      throw;
+   }
+   delete z;
+}
+
+// the side of a file of --left/--right: 0 left, 1 right
+// (the side of the longest root it is under)
+static int __side(const std::string& path, const fvec_t& lefts, 
+   const fvec_t& rights) {
+   size_t best = 0;
+   int side = 0;
+   for(int k = 0; k < 2; ++k) {
+      const fvec_t& roots = k ? rights : lefts;
+      for(int i = 0; i < (int)roots.size(); ++i) {
+         const std::string& r = roots[i];
+         if (r.size() < best || path.compare(0,r.size(),r)) continue;
+         if (path.size() > r.size() && path[r.size()] != '/' && 
+            r[r.size() - 1] != '/') continue;
+         best = r.size(), side = k;
+      }
+   }
+   return side;
+}
+
+// the sets with files on both sides (--left/--right), left files first
+static void __cross(res_t& res, const res_t& cmn, const fvec_t& lefts,
+   const fvec_t& rights) {
+   for(res_t::const_iterator it = cmn.begin(); it != cmn.end(); ++it) {
+      fvec_t l, r;
+      const std::string& key = it->first.path();
+      (__side(key,lefts,rights) ? r : l).push_back(key);
+      for(int i = 0; i < (int)it->second.size(); ++i)
+         (__side(it->second[i],lefts,rights) ? r : l).push_back(it->second[i]);
+      if (l.empty() || r.empty()) continue;
+      l.insert(l.end(),r.begin(),r.end());
+      res[filei(l[0],it->first.md5())] = fvec_t(l.begin() + 1,l.end());
+   }
+}
+
+// add the identical sets of a size group to a report
+static void __collect(std::vector<fgroup>& groups, const res_t& res, 
+   size_t size) {
+   for(res_t::const_iterator it = res.begin(); it != res.end(); ++it) {
+      groups.push_back(fgroup());
+      fgroup& g = groups.back();
+      g.size = size;
+      ::memcpy(g.md5,it->first.md5(),16);
+      g.paths = it->second;
+      g.paths.push_back(it->first.path());
+      std::sort(g.paths.begin(),g.paths.end());
+   }
+}
+
+// what to do with a size group: 
+// 0 nothing, 1 compare its two files, 2 hash its files
+static int __plan(size_t size, size_t n, size_t nk, bool ep, bool ph,
+   int shard, int shards) {
+   // less than two in set (or members of another shard)
+   if (n + nk < 2) return 0;
+   if (shards && freport::shard(size,shards) != shard) return 0;
+   // exactly two in set, and don't care about printing hash
+   // (but files to tree hash are hashed)
+   if (!ep && !nk && n == 2 && !ph && !shards &&
+      !(filei::_tree && size > __UATREECHUNK)) return 1;
+   return 2;
+}
+
+// hashing a file (or comparing two) on the scheduler (--io-jobs)
+struct __job: public fsched::job {
+   std::string path;
+   std::string other; // compare with this if not empty
+   std::string next; // the file queued after it, read ahead (--nocache)
+   bool ic, iw;
+   size_t m, bs;
+   filei* fi;
+   bool same;
+   const char* error;
+
+   __job(const std::string& p, bool i, bool w, size_t mx, size_t b,
+      const std::string& o = std::string()): path(p), other(o),
+      ic(i), iw(w), m(mx), bs(b), fi(0), same(false), error(0) {}
+   ~__job() { delete fi; }
+
+   void run() {
+      if (next.size()) filei::prefetch(next);
+      try {
+         if (other.size()) same = filei::eq(path,other,ic,iw,0,bs);
+         else fi = new filei(path,ic,iw,m,bs);
+      } catch(const char* e) {
+         error = e;
+      }
+   }
+};
+
+// queue a job on the device of its file
+static __job* __submit(fsched& s, __job* j) {
+   struct stat st;
+   s.submit(j,::stat(j->path.c_str(),&st) ? 0 : st.st_dev);
+   return j;
+}
+
+// whether a size group is compared by the bytes of its files
+// (which needs the sizes, and the files as they are)
+static bool __issmall(size_t size, size_t nk, bool ep, bool count, bool iw) {
+   return count && size <= __UASMALLFILE && !nk && !ep && !iw && 
+      !filei::_sparse;
+}
+
+// the end of the --time-budget (0 if none)
+static double __deadline = 0;
+
+// whether the time budget is spent, checked as the files of a size
+// group are done (the group is then given up, not reported in part)
+static bool __late() {
+   return __deadline && fprobe::now() >= __deadline;
+}
+
+// orders the files of an arena by their bytes
+struct __bytecmp {
+   const char* a;
+   size_t n;
+   bool operator()(int i, int j) const { 
+      return ::memcmp(a + i * n,a + j * n,n) < 0; 
+   }
+};
+
+// the identical sets of a size group of small files: the files are 
+// read into an arena and sorted by their bytes, only one file of each
+// set is hashed (for the output), the empty files are not even opened
+// (-i is applied to the bytes)
+//
+// The arena holds at most __UASMALLARENA bytes. The files of a larger
+// group are read a part at a time, and then every file is hashed (from
+// the arena, not read again), so that the sets are joined across the
+// parts by their hashes. False if the time budget ran out.
+static bool __smallsets(res_t& res, const fvec_t& fv, size_t size, bool ic,
+   bool v) {
+   size_t per = size ? std::max((size_t)1,__UASMALLARENA / size) : fv.size();
+   bool parts = fv.size() > per;
+   std::vector<char> arena(std::min(fv.size(),per) * size + 1);
+   fslurp s;
+   res_t all; // with the files of no set, when in parts
+   res_t& sets = parts ? all : res;
+
+   for(size_t first = 0; first < fv.size(); first += per) {
+      size_t n = std::min(per,fv.size() - first);
+      std::vector<int> ok; // the files read (of the part)
+      for(int i = 0; i < (int)n; ++i) {
+         if (__late()) return false;
+         const std::string& path = fv[first + i];
+         char* b = &arena[i * size];
+         const char* e = size ? s.read(path,b,size) : 0;
+         if (e) {
+            if (v) std::cerr << "Skipping " << path << ", " << e << std::endl;
+            continue;
+         }
+         if (ic) for(char* p = b; p < b + size; ++p) 
+            if (*p <= 'Z' && *p >= 'A') *p += 'a' - 'A';
+         ok.push_back(i);
+         if (v) std::cerr << "Processed " << path << std::endl;
+      }
+
+      __bytecmp cmp = { &arena[0], size };
+      std::stable_sort(ok.begin(),ok.end(),cmp);
+      for(int i = 0, j; i < (int)ok.size(); i = j) {
+         for(j = i + 1; j < (int)ok.size() && !cmp(ok[i],ok[j]); ++j);
+         if (j - i < 2 && !parts) continue;
+         fmem bytes(&arena[ok[i] * size],size);
+         filei f(fv[first + ok[i]],bytes,false,false);
+         res_t::iterator it = sets.find(f);
+         if (it == sets.end()) 
+            it = sets.insert(std::make_pair(f,fvec_t())).first;
+         else it->second.push_back(f.path());
+         for(int k = i + 1; k < j; ++k) it->second.push_back(fv[first + ok[k]]);
+      }
+   }
+
+   for(res_t::const_iterator it = all.begin(); it != all.end(); ++it) 
+      if (it->second.size()) res.insert(*it);
+   return true;
+}
+
+// the jobs of the size groups, submitted ahead of the group loop
+// in its order, so that the devices are kept busy while it waits
+class __ahead {
+   private:
+      fsched& _s;
+      const std::vector<fsetc_t::const_iterator>& _order;
+      const fsetk_t& _known;
+      const fjournal* _jr; // the hashes known from it are not calculated
+      size_t _g; // next group to submit
+      std::deque<__job*> _q;
+      bool _ic, _iw, _stage, _ph, _count;
+      size_t _max, _bs;
+      int _shard, _shards;
+
+      // submit the next groups
+      void fill() {
+         for(; _q.size() < __UASCHEDAHEAD && _g < _order.size(); ++_g) {
+            fsetc_t::const_iterator fct = _order[_g];
+            fsetk_t::const_iterator kct = _known.find(fct->first);
+            size_t nk = kct == _known.end() ? 0 : kct->second.size();
+            const fvec_t& fv = fct->second;
+            switch(__plan(fct->first,fv.size(),nk,false,_ph,_shard,_shards)) {
+               case 1:
+                  if (_count && !fct->first) break; // empty, not opened
+                  _q.push_back(__submit(_s,
+                     new __job(fv[0],_ic,_iw,0,_bs,fv[1])));
+                  break;
+               case 2: {
+                  if (!_jr && __issmall(fct->first,nk,false,_count,_iw)) 
+                     break;
+                  size_t m = nk && _stage ? 0 : _max;
+                  unsigned char md5[16];
+                  for(int i = 0; i < (int)fv.size(); ++i) {
+                     if (_jr && _jr->digest(fv[i],m,md5)) continue;
+                     __job* j = new __job(fv[i],_ic,_iw,m,_bs);
+                     if (i + 1 < (int)fv.size()) j->next = fv[i + 1];
+                     _q.push_back(__submit(_s,j));
+                  }
+                  break;
+               }
+            }
+         }
+      }
+
+   public:
+      __ahead(fsched& s, const std::vector<fsetc_t::const_iterator>& order,
+         const fsetk_t& known, const fjournal* jr, bool ic, bool iw, 
+         bool stage, bool ph, bool count, size_t m, size_t bs, int shard, 
+         int shards): _s(s), _order(order), _known(known), _jr(jr), _g(0), 
+         _ic(ic), _iw(iw), 
+         _stage(stage), _ph(ph), _count(count), _max(m), _bs(bs), 
+         _shard(shard), _shards(shards) {}
+
+      // the jobs not started are dropped (the budget is spent)
+      ~__ahead() {
+         for(int i = (int)_q.size() - 1; i >= 0; --i) {
+            if (!_s.cancel(_q[i])) _s.wait(_q[i]);
+            delete _q[i];
+         }
+      }
+
+      // the next job of the group loop (done, to be deleted)
+      __job* next() {
+         fill();
+         __job* j = _q.front();
+         _q.pop_front();
+         _s.wait(j);
+         return j;
+      }
+};
+
+// fset_t::common on the scheduler (if any), the files of all subsets at
+// once; with a journal, the full hashes in it are taken and the new ones
+// added to it; false if the time budget ran out (the jobs left are dropped)
+static bool __common(fsched* s, fjournal* jr, res_t& res, const res_t& cmn, 
+   bool ic, bool iw, size_t bs, bool v) {
+   std::vector<__job*> js;
+   std::vector<char> fresh; // hashed now (not taken from the journal)
+   for(res_t::const_iterator it = cmn.begin(); it != cmn.end(); ++it) {
+      for(size_t i = 0; i <= it->second.size(); ++i) {
+         const std::string& path = i ? it->second[i - 1] : it->first.path();
+         __job* j = new __job(path,ic,iw,0,bs);
+         if (i < it->second.size()) j->next = it->second[i];
+         unsigned char md5[16];
+         bool known = jr && jr->digest(path,0,md5);
+         if (known) j->fi = new filei(path,md5);
+         else if (s) __submit(*s,j);
+         else if (!__late()) j->run();
+         js.push_back(j);
+         fresh.push_back(!known);
+      }
+   }
+
+   size_t k = 0;
+   bool late = false;
+   for(res_t::const_iterator it = cmn.begin(); !late && it != cmn.end(); ++it) {
+      fset_t files(ic,iw,0,bs);
+      for(size_t i = 0; i <= it->second.size() && !(late = __late()); 
+         ++i, ++k) {
+         __job* j = js[k];
+         if (s && fresh[k]) s->wait(j);
+         if (jr && fresh[k] && !j->error) jr->hashed(j->path,0,j->fi->md5());
+         if (j->error) {
+            if (v) std::cerr << "Skipping " << j->path << ", " << j->error 
+                             << std::endl;
+         } else files.add(*j->fi);
+         delete j;
+      }
+      if (late) break;
+      const res_t& locmn = files.common();
+      for(res_t::const_iterator lit = locmn.begin(); lit != locmn.end(); ++lit)
+         res[lit->first] = lit->second;
+   }
+
+   // the hashes done are still journaled
+   for(; k < js.size(); ++k) {
+      __job* j = js[k];
+      bool done = s ? fresh[k] && !s->cancel(j) : j->fi || j->error;
+      if (s && done) s->wait(j);
+      if (jr && fresh[k] && done && !j->error) 
+         jr->hashed(j->path,0,j->fi->md5());
+      delete j;
+   }
+   return !late;
+}
+
+// the work of the group loop, for the progress report
+static void __totals(const fsetc_t& files, const fsetk_t& known, 
+   const eager_t& eager, bool stage, bool ph, size_t max, 
+   int shard, int shards) {
+   for(fsetc_t::const_iterator fct = files.begin(); fct != files.end(); ++fct) {
+      fsetk_t::const_iterator kct = known.find(fct->first);
+      size_t nk = kct == known.end() ? 0 : kct->second.size();
+      bool ep = eager.find(fct->first) != eager.end();
+      size_t n = fct->second.size(), m = nk && stage ? 0 : max;
+      uint64_t b = m ? std::min(fct->first,m) : fct->first;
+      switch(__plan(fct->first,n,nk,ep,ph,shard,shards)) {
+         case 1:
+            fprogress::total(fprogress::HASH,2,2 * (uint64_t)fct->first);
+            break;
+         case 2:
+            fprogress::total(fprogress::HASH,n,n * b);
+            if (ep) fprogress::done(fprogress::HASH,n,n * b); // with -j
+            break;
+      }
+   }
+}
+
+// depths of the queues, for the progress report
+static size_t __sqdepth(const void* q) {
+   return static_cast<const fstatq*>(q)->pending();
+}
+
+static size_t __iodepth(const void* q) {
+   return const_cast<fsched*>(static_cast<const fsched*>(q))->pending();
+}
+
+// the device model of --auto, by fsched::kind_t:
+// seek time (s), transfer rate (bytes/s) and buffer size
+static const double __seek[] = { 8e-3, 1e-4, 1e-3, 1e-5 };
+static const double __rate[] = { 150e6, 500e6, 100e6, 2e9 };
+static const int __bsize[] = { 4 << 20, 1 << 17, 1 << 20, 1 << 17 };
+static const char* __kinds[] = { "rotational", "flash", "network", "memory" };
+
+// prefixes --auto considers, and how many files it samples
+static const size_t __prefixes[] = { 4096, 65536 };
+static const int __NPREFIXES = 2;
+static const int __AUTOSAMPLE = 256;
+
+// estimated time of hashing the size groups of more than two files,
+// in one stage (p = 0) or two (with a prefix of p bytes, f of the files
+// sharing their prefix with another)
+static double __cost(const fsetc_t& files, int kind, size_t p, double f,
+   size_t bs, bool ph) {
+   double t = 0;
+   for(fsetc_t::const_iterator fct = files.begin(); fct != files.end(); ++fct) {
+      double n = fct->second.size(), s = fct->first;
+      if (__plan(fct->first,fct->second.size(),0,false,ph,0,0) != 2) continue;
+      double b = p ? std::min(s,(double)p) : s;
+      t += n * (__seek[kind] + b / __rate[kind]);
+      if (p && s > p) t += f * n * (__seek[kind] + s / __rate[kind]);
+      // the lanes of the multi-buffer hash take turns on the disk
+      if (kind == fsched::DISK) 
+         t += (n * b + (p && s > p ? f * n * s : 0)) / bs * __seek[kind];
+   }
+   return t;
+}
+
+// --auto: choose -2, -m and -b from the size groups and the device
+// the kind of the device of the largest groups (fsched::kind_t)
+static int __kind(const fsetc_t& files) {
+   std::vector<std::pair<double,const fvec_t*> > big;
+   for(fsetc_t::const_iterator fct = files.begin(); fct != files.end(); ++fct) 
+      if (fct->second.size() > 1)
+         big.push_back(std::make_pair(-(double)fct->first * 
+            fct->second.size(),&fct->second));
+   std::sort(big.begin(),big.end());
+   int kinds[4] = { 0, 0, 0, 0 };
+   for(int i = 0; i < (int)big.size() && i < 16; ++i) {
+      struct stat st;
+      if (!::stat((*big[i].second)[0].c_str(),&st)) 
+         ++kinds[fsched::kind(st.st_dev)];
+   }
+   return std::max_element(kinds,kinds + 4) - kinds;
+}
+
+static void __auto(const fsetc_t& files, bool ic, bool ph,
+   bool& stage, int& max, int& BN, bool v) {
+
+   int kind = __kind(files);
+
+   // how many files share a prefix with another, from a sample of groups
+   double f[__NPREFIXES];
+   int sampled[__NPREFIXES];
+   for(int k = 0; k < __NPREFIXES; ++k) {
+      size_t p = __prefixes[k];
+      int n = 0, same = 0, groups = 0;
+      for(fsetc_t::const_iterator fct = files.begin(); fct != files.end(); 
+         ++fct) if (fct->first > p && fct->second.size() > 2) ++groups;
+      int every = std::max(1,groups / std::max(1,__AUTOSAMPLE / 4));
+      int g = 0;
+      for(fsetc_t::const_iterator fct = files.begin(); 
+         fct != files.end() && n < __AUTOSAMPLE; ++fct) {
+         if (fct->first <= p || fct->second.size() <= 2 || g++ % every) 
+            continue;
+         fset_t prefixes(ic,false,p,__bsize[kind]);
+         std::vector<const char*> errs;
+         prefixes.add(fct->second,errs);
+         const res_t& cmn = prefixes.common();
+         for(res_t::const_iterator it = cmn.begin(); it != cmn.end(); ++it)
+            same += 1 + it->second.size();
+         n += fct->second.size();
+      }
+      f[k] = n ? (double)same / n : 1;
+      sampled[k] = n;
+   }
+
+   int bs = __bsize[kind];
+   double best = __cost(files,kind,0,1,bs,ph);
+   if (v) std::cerr << "Auto: " << __kinds[kind] << " device, one stage " 
+                    << best << "s";
+   size_t choice = 0;
+   for(int k = 0; k < __NPREFIXES; ++k) {
+      double t = __cost(files,kind,__prefixes[k],f[k],bs,ph);
+      if (v) {
+         std::cerr << ", -2 -m " << __prefixes[k] << " " << t << "s (";
+         if (sampled[k]) std::cerr << (int)(100 * f[k]) << "% of " 
+                                   << sampled[k] << " share the prefix)";
+         else std::cerr << "no larger files)";
+      }
+      if (t < best) best = t, choice = __prefixes[k];
+   }
+
+   // no larger than the largest file
+   size_t largest = 1024;
+   for(fsetc_t::const_iterator fct = files.begin(); fct != files.end(); ++fct)
+      if (fct->second.size() > 1) largest = std::max(largest,fct->first);
+
+   stage = choice > 0;
+   max = choice;
+   BN = std::min((size_t)bs,largest);
+   if (v) {
+      std::cerr << std::endl << "Auto:";
+      if (stage) std::cerr << " -2 -m " << max;
+      std::cerr << " -b " << BN << std::endl;
+   }
+}
+
+// orders pairs by their first members only
+struct __first {
+   template<typename P> bool operator()(const P& a, const P& b) const {
+      return a.first < b.first;
+   }
+};
+
+// the order of the size groups: as they are, or by payoff (--payoff), the
+// bytes a group may free (all of its files but one) per second it takes
+// to read, in the model of --auto; with a byte budget, the groups that 
+// would not fit in what is left of it are left out
+// (returns how many of those are to be compared)
+static size_t __order(std::vector<fsetc_t::const_iterator>& order, 
+   const fsetc_t& files, const fsetk_t& known, bool payoff, double budget,
+   bool ph, int shard, int shards) {
+   if (!payoff) {
+      for(fsetc_t::const_iterator fct = files.begin(); fct != files.end(); 
+         ++fct) order.push_back(fct);
+      return 0;
+   }
+
+   int kind = __kind(files);
+   std::vector<std::pair<double,fsetc_t::const_iterator> > pay;
+   for(fsetc_t::const_iterator fct = files.begin(); fct != files.end(); ++fct) {
+      fsetk_t::const_iterator kct = known.find(fct->first);
+      double nk = kct == known.end() ? 0 : kct->second.size();
+      double n = fct->second.size(), s = fct->first;
+      double t = n * (__seek[kind] + s / __rate[kind]);
+      double freed = n + nk > 1 ? s * (n + nk - 1) : 0;
+      // the groups of known hashes only cost nothing
+      pay.push_back(std::make_pair(t ? -freed / t : -HUGE_VAL,fct));
+   }
+   std::stable_sort(pay.begin(),pay.end(),__first());
+
+   size_t out = 0;
+   for(int i = 0; i < (int)pay.size(); ++i) {
+      fsetc_t::const_iterator fct = pay[i].second;
+      fsetk_t::const_iterator kct = known.find(fct->first);
+      size_t nk = kct == known.end() ? 0 : kct->second.size();
+      if (!__plan(fct->first,fct->second.size(),nk,false,ph,shard,shards))
+         continue;
+      double b = (double)fct->first * fct->second.size();
+      if (budget && b > budget) { ++out; continue; }
+      if (budget) budget -= b;
+      order.push_back(fct);
+   }
+   return out;
+}
+
+// print the sets as md5sum lines (--md5sum)
+static void __md5sum(const res_t& res) {
+   for(res_t::const_iterator it = res.begin(); it != res.end(); ++it) {
+      fsums::write(std::cout,it->first.md5(),it->first.path());
+      for(int i = 0; i < (int)it->second.size(); ++i)
+         fsums::write(std::cout,it->first.md5(),it->second[i]);
+   }
+}
+
+// with a journal, SIGINT and SIGTERM stop the scan after the file or the
+// size group at hand, so that the journal is flushed (a second one kills)
+static volatile sig_atomic_t __interrupted = 0;
+
+static void __interrupt(int) {
+   __interrupted = 1;
+}
+
+static void __interruptible() {
+   struct sigaction sa;
+   ::memset(&sa,0,sizeof(sa));
+   sa.sa_handler = &__interrupt;
+   sa.sa_flags = SA_RESETHAND | SA_RESTART;
+   ::sigaction(SIGINT,&sa,0);
+   ::sigaction(SIGTERM,&sa,0);
+}
+
+// drop the files the index knows (--ignore-known) from the size groups:
+// the prefixes of the files are hashed unless the index has no file of 
+// their size, and the whole files if it has one with their prefix; the
+// others keep their full hash as known (not to be hashed again)
+static void __ignore(const findex& idx, fsetc_t& files, fsetk_t& known,
+   bool ic, size_t bs, bool v) {
+   size_t p = idx.prefix();
+   for(fsetc_t::iterator fct = files.begin(); fct != files.end(); ++fct) {
+      fvec_t& fv = fct->second;
+      fsetk_t::const_iterator kct = known.find(fct->first);
+      size_t nk = kct == known.end() ? 0 : kct->second.size();
+      if (fv.size() + nk < 2 || !idx.may(fct->first)) continue;
+
+      std::vector<filei> pre;
+      std::vector<const char*> errs;
+      filei::hashn(fv,ic,false,p,bs,pre,errs);
+      std::set<std::string> out; // known, or hashed in full
+      for(int i = 0; i < (int)pre.size(); ++i) {
+         const filei& pf = pre[i];
+         if (!idx.has(fct->first,pf.md5())) continue;
+         try {
+            filei f = fct->first > p ? filei(pf.path(),ic,false,0,bs) : pf;
+            fvec_t paths;
+            if (idx.find(fct->first,pf.md5(),f.md5(),paths)) {
+               if (v) std::cerr << "Known " << f.path() << std::endl;
+            } else known[fct->first].push_back(f);
+            out.insert(f.path());
+         } catch(const char* e) {
+            if (v) std::cerr << "Skipping " << pf.path() << ", " << e 
+                             << std::endl;
+         }
+      }
+      if (out.empty()) continue;
+
+      fvec_t rest;
+      for(int i = 0; i < (int)fv.size(); ++i) 
+         if (!out.count(fv[i])) rest.push_back(fv[i]);
+      fv.swap(rest);
+   }
+}
+
+// drop the size groups left with files on one side only (--left/--right),
+// after --ignore-known has taken out some of them
+static void __bothsides(fsetc_t& files, fsetk_t& known, 
+   const fvec_t& lefts, const fvec_t& rights) {
+   for(fsetc_t::iterator fct = files.begin(); fct != files.end();) {
+      int sides = 0;
+      const fvec_t& fv = fct->second;
+      for(int i = 0; i < (int)fv.size(); ++i) 
+         sides |= 1 << __side(fv[i],lefts,rights);
+      fsetk_t::iterator kct = known.find(fct->first);
+      if (kct != known.end()) {
+         for(int i = 0; i < (int)kct->second.size(); ++i)
+            sides |= 1 << __side(kct->second[i].path(),lefts,rights);
+      }
+      if (sides == 3) { ++fct; continue; }
+      if (kct != known.end()) known.erase(kct);
+      files.erase(fct++);
+   }
+}
+
+// the end of a run: the last status and the latency report
+static void __finish(int slowest) {
+   fprogress::stop();
+   if (fprobe::_on) fprobe::report(std::cerr,slowest);
+}
+
+// the options of a run
+struct __run {
+   bool ic; // ignore case
+   bool iw; // ignore white space
+   bool v; // verbose
+   bool stage; // two stage
+   int BN; // buffer size
+   bool ph; // print hash
+   bool count; // take size into account
+   bool archives; // look into archives
+   int shard, shards; // --shard shard/shards (0: not sharded)
+   int jobs; // stat threads (0: stat in turn, no pipeline)
+   std::string index; // --build-index
+   fvec_t lists; // -l
+   fvec_t roots; // -r
+   fvec_t lefts, rights; // --left, --right
+   int lowmem; // MB of the size sketch (0: one pass)
+   bool dirs; // compare directories
+   bool manifest; // prune subtrees by manifest
+   double bps, iops; // --max-read-rate
+   double latency; // --adaptive
+   fsched* sched; // --io-jobs
+   bool progress; // --progress
+   std::string pfile; // status file of --progress
+   bool automatic; // --auto
+   int slowest; // --latency: slowest files to report
+   bool md5sum; // --md5sum
+   fsums* trust; // --trust-manifest
+   bool payoff; // --payoff
+   double tbudget, bbudget; // --time-budget, --byte-budget
+   std::string journal; // --journal
+   bool resume; // --resume
+   findex* kidx; // --ignore-known
+   bool variants; // --variants
+   std::string prev; // --diff-against
+   int max; // max chars to consider, ALL
+   bool comm; // from command line
+   bool join; // --left, --right
+   std::string sep; // separator
+
+   __run(): ic(false), iw(false), v(false), stage(false), BN(1024),
+      ph(false), count(true), archives(false), shard(0), shards(0), jobs(0),
+      lowmem(0), dirs(false), manifest(false), bps(0), iops(0), latency(0),
+      sched(0), progress(false), automatic(false), slowest(0),
+      md5sum(false), trust(0), payoff(false), tbudget(0), bbudget(0),
+      resume(false), kidx(0), variants(false), max(0), comm(true),
+      join(false), sep(" ") {}
+
+   ~__run() {
+      delete sched;
+      delete trust;
+      delete kidx;
    }
 
+   private:
+      // no copy
+      __run(const __run&);
+      __run& operator=(const __run&);
+};
+
+// the options of the command line, -1 to go on or the exit code
+static int __parse(__run& r, int argc, char* const * argv) {
    int opt;
-   while((opt = ::getopt(argc,argv,"hb:viws:m:2pn")) != -1) {
+   while((opt = ::getopt_long(argc,argv,"hb:viws:m:2pnaj:l:r:",
+      __lopts,0)) != -1) {
       switch(opt) {
          case 'b':
-            BN = ::atoi(::optarg);
-            if (!BN) {
+            r.BN = ::atoi(::optarg);
+            if (!r.BN) {
                std::cerr << "Invalid buffer size " << ::optarg << std::endl;
                return 1;
             }
             break;
          case 'm':
-            max = ::atoi(::optarg);
+            r.max = ::atoi(::optarg);
             break;
          case 'i':
-            ic = true;
+            r.ic = true;
             break;
          case 'v':
-            v = true;
+            r.v = true;
             break;
          case 'w':
-            iw = true;
+            r.iw = true;
             break;
          case 's':
-            sep = std::string(::optarg);
+            r.sep = std::string(::optarg);
             break;
          case '2':
-            stage = true;
+            r.stage = true;
             break;
          case 'p':
-            ph = true;
+            r.ph = true;
             break;
          case 'n':
-            count = false;
+            r.count = false;
+            break;
+         case 'a':
+            r.archives = true;
+            break;
+         case 'l':
+            r.lists.push_back(::optarg);
+            break;
+         case 'r':
+            r.roots.push_back(::optarg);
+            break;
+         case OPT_LEFT:
+            r.lefts.push_back(::optarg);
+            break;
+         case OPT_RIGHT:
+            r.rights.push_back(::optarg);
+            break;
+         case OPT_LOWMEM:
+            r.lowmem = ::optarg ? ::atoi(::optarg) : 16;
+            if (r.lowmem < 1) {
+               std::cerr << "Invalid sketch size " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         case 'j':
+            r.jobs = ::atoi(::optarg);
+            if (r.jobs < 1) {
+               std::cerr << "Invalid number of jobs " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         case OPT_NOCACHE:
+            filei::_iomode = filei::IO_NOCACHE;
+            break;
+         case OPT_DIRECT:
+            filei::_iomode = filei::IO_DIRECT;
+            break;
+         case OPT_SPARSE:
+            filei::_sparse = true;
+            break;
+         case OPT_RATE:
+            if (!fthrottle::parse(::optarg,r.bps,r.iops)) {
+               std::cerr << "Invalid rate " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         case OPT_ADAPTIVE:
+            r.latency = ::optarg ? ::atof(::optarg) : 20;
+            if (r.latency <= 0) {
+               std::cerr << "Invalid latency " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         case OPT_IOPRIO:
+            if (!fthrottle::ioprio(::optarg)) {
+               std::cerr << "Could not set I/O priority " << ::optarg
+                         << std::endl;
+               return 1;
+            }
+            break;
+         case OPT_IOJOBS: {
+            std::map<dev_t,int> budgets;
+            int all = 0;
+            if (::optarg && !fsched::parse(::optarg,budgets,all)) {
+               std::cerr << "Invalid I/O jobs " << ::optarg << std::endl;
+               return 1;
+            }
+            delete r.sched;
+            r.sched = new fsched(budgets,all);
+            break;
+         }
+         case OPT_PROGRESS:
+            r.progress = true;
+            if (::optarg) r.pfile = std::string(::optarg);
+            break;
+         case OPT_LATENCY:
+            r.slowest = ::optarg ? ::atoi(::optarg) : 10;
+            if (r.slowest < 0) {
+               std::cerr << "Invalid number of files " << ::optarg
+                         << std::endl;
+               return 1;
+            }
+            fprobe::_on = true;
+            break;
+         case OPT_AUTO:
+            r.automatic = true;
+            break;
+         case OPT_MD5SUM:
+            r.md5sum = r.ph = true;
+            break;
+         case OPT_IGNORE:
+            try {
+               delete r.kidx;
+               r.kidx = 0;
+               r.kidx = new findex(::optarg);
+            } catch(const char* e) {
+               std::cerr << e << " " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         case OPT_VARIANTS:
+            r.variants = true;
+            break;
+         case OPT_REPORT:
+            if (!r.shards) r.shard = 0, r.shards = 1;
+            break;
+         case OPT_DIFF:
+            r.prev = ::optarg;
+            break;
+         case OPT_JOURNAL:
+            r.journal = ::optarg;
+            break;
+         case OPT_RESUME:
+            r.resume = true;
+            break;
+         case OPT_PAYOFF:
+            r.payoff = true;
+            break;
+         case OPT_TBUDGET: {
+            char* e = 0;
+            r.tbudget = ::strtod(::optarg,&e);
+            if (*e == 'm') r.tbudget *= 60, ++e;
+            else if (*e == 'h') r.tbudget *= 3600, ++e;
+            else if (*e == 's') ++e;
+            if (r.tbudget <= 0 || *e) {
+               std::cerr << "Invalid time budget " << ::optarg << std::endl;
+               return 1;
+            }
+            __deadline = fprobe::now() + r.tbudget;
+            r.payoff = true;
+            break;
+         }
+         case OPT_BBUDGET: {
+            double iops = 0;
+            if (!fthrottle::parse(::optarg,r.bbudget,iops) || iops ||
+               r.bbudget <= 0) {
+               std::cerr << "Invalid byte budget " << ::optarg << std::endl;
+               return 1;
+            }
+            r.payoff = true;
+            break;
+         }
+         case OPT_TRUST:
+            if (!r.trust) r.trust = new fsums();
+            try {
+               r.trust->load(::optarg);
+            } catch(const char* e) {
+               std::cerr << e << " " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         case OPT_DIRS:
+            r.dirs = true;
+            break;
+         case OPT_MANIFEST:
+            r.manifest = true;
+            break;
+         case OPT_TREE:
+            filei::_tree = ::optarg ? ::atoi(::optarg) : __UATREEJOBS;
+            if (filei::_tree < 1) {
+               std::cerr << "Invalid number of threads " << ::optarg
+                         << std::endl;
+               return 1;
+            }
+            break;
+         case OPT_INDEX:
+            r.index = std::string(::optarg);
+            break;
+         case OPT_SHARD:
+            if (::sscanf(::optarg,"%d/%d",&r.shard,&r.shards) != 2 ||
+               r.shards < 1 || r.shard < 0 || r.shard >= r.shards) {
+               std::cerr << "Invalid shard " << ::optarg << std::endl;
+               return 1;
+            }
             break;
          case 'h':
-            __phelp(v);
+            __phelp(r.v);
             return 0;
          case '?':
             std::cerr << "Type " << argv[0] << " -h for options." << std::endl;
             return 1;
       }
    }
+   return -1;
+}
 
-   if (stage && !max) {
-      std::cerr << "The two stage algorithm requires -m set!" << std::endl;
-      return 1;
+// what a run is asked to do, as far as the options that do not go
+// together are concerned (the bits of __conflicts, in the order of
+// __fnames)
+enum {
+   F_STAGE = 1 << 0, F_MAX = 1 << 1, F_N = 1 << 2, F_W = 1 << 3,
+   F_I = 1 << 4, F_A = 1 << 5, F_ARGS = 1 << 6, F_STDIN = 1 << 7,
+   F_L = 1 << 8, F_R = 1 << 9, F_REPORT = 1 << 10, F_DIFF = 1 << 11,
+   F_BUDGET = 1 << 12, F_INDEX = 1 << 13, F_DIRS = 1 << 14,
+   F_MANIFEST = 1 << 15, F_LOWMEM = 1 << 16, F_VARIANTS = 1 << 17,
+   F_LEFT = 1 << 18, F_RIGHT = 1 << 19, F_AUTO = 1 << 20,
+   F_PAYOFF = 1 << 21, F_MD5SUM = 1 << 22, F_TRUST = 1 << 23,
+   F_IGNORE = 1 << 24, F_JOURNAL = 1 << 25, F_RESUME = 1 << 26,
+   F_SPARSE = 1 << 27, F_TREE = 1 << 28,
+   F_NOSIZE = 1 << 29, // no file sizes (-n, -w, -m without -2)
+   F_PREFIX = 1 << 30  // the hashes of prefixes only (-m without -2)
+};
+
+static const char* __fnames[] = {
+   "-2", "-m", "-n", "-w", "-i", "-a", "file names", "-", "-l", "-r",
+   "--shard, --report or --diff-against", "--diff-against", "a budget",
+   "--build-index", "--dirs", "--manifest", "--lowmem", "--variants",
+   "--left", "--right", "--auto", "--payoff", "--md5sum",
+   "--trust-manifest", "--ignore-known", "--journal", "--resume",
+   "--sparse", "--tree", "-n, -w or -m without -2 (no file sizes)",
+   "-m without -2 (hashes of prefixes)"
+};
+
+// the options that do not go together: a run asked any of what is
+// refused if it is asked none of needs (if any) or any of excludes
+struct __conflict {
+   unsigned what, needs, excludes;
+};
+
+static const __conflict __conflicts[] = {
+   { F_AUTO, 0, F_STAGE | F_MAX | F_N | F_W | F_A | F_INDEX | F_DIRS },
+   { F_STAGE, F_MAX, 0 },
+   { F_REPORT, 0, F_NOSIZE },
+   { F_DIFF, 0, F_BUDGET },
+   { F_INDEX, 0, F_NOSIZE | F_MAX | F_A | F_REPORT },
+   { F_TRUST | F_MD5SUM, 0, F_I | F_W | F_PREFIX | F_SPARSE | F_TREE |
+      F_INDEX | F_DIRS },
+   { F_PAYOFF | F_BUDGET, 0, F_NOSIZE | F_INDEX | F_DIRS },
+   { F_MD5SUM, 0, F_REPORT },
+   { F_IGNORE, 0, F_NOSIZE | F_PREFIX | F_INDEX | F_DIRS },
+   { F_RESUME, F_JOURNAL, 0 },
+   { F_JOURNAL, 0, F_A | F_LOWMEM | F_INDEX | F_DIRS },
+   { F_LEFT, F_RIGHT, 0 },
+   { F_RIGHT, F_LEFT, 0 },
+   { F_LEFT | F_RIGHT, 0, F_ARGS | F_L | F_R | F_NOSIZE | F_A | F_INDEX |
+      F_DIRS },
+   { F_MANIFEST, F_DIRS, 0 },
+   { F_DIRS, F_R, F_ARGS | F_L | F_NOSIZE | F_A | F_REPORT | F_INDEX |
+      F_LOWMEM | F_VARIANTS },
+   { F_VARIANTS, 0, F_I | F_W | F_STAGE | F_A | F_REPORT | F_INDEX |
+      F_LOWMEM | F_LEFT | F_RIGHT | F_AUTO | F_PAYOFF | F_BUDGET |
+      F_MD5SUM | F_TRUST | F_IGNORE | F_JOURNAL | F_SPARSE | F_TREE },
+   { F_LOWMEM, 0, F_STDIN | F_NOSIZE | F_A | F_INDEX }
+};
+
+// the names of the options of some bits
+static std::string __named(unsigned f, const char* sep) {
+   std::string s;
+   for(int b = 0; b < (int)(sizeof(__fnames) / sizeof(*__fnames)); ++b) {
+      if (!(f & 1u << b)) continue;
+      if (s.size()) s += sep;
+      s += __fnames[b];
    }
+   return s;
+}
 
-   if (count && iw) count = false;
+// refuse the options that do not go together (after setting what they
+// imply), 0 if they do
+static int __check(__run& r, int argc, char* const * argv) {
+   // -n, -w and -m without -2 take the sizes out of the size groups
+   bool raw = r.count;
+   if (r.count && r.iw) r.count = false;
+   if (r.count && r.max && !r.stage) r.count = false;
+   // --diff-against is of the whole report
+   if (r.prev.size() && !r.shards) r.shard = 0, r.shards = 1;
 
-   if (count && max && !stage) count = false;
+   const bool on[] = { // in the order of the bits
+      r.stage, r.max != 0, !raw, r.iw, r.ic, r.archives, argc > ::optind,
+      argc > ::optind && *argv[::optind] == '-', !r.lists.empty(),
+      !r.roots.empty(), r.shards != 0, !r.prev.empty(),
+      r.tbudget || r.bbudget, !r.index.empty(), r.dirs, r.manifest,
+      r.lowmem != 0, r.variants, !r.lefts.empty(), !r.rights.empty(),
+      r.automatic, r.payoff && !r.tbudget && !r.bbudget, r.md5sum,
+      r.trust != 0, r.kidx != 0, !r.journal.empty(), r.resume,
+      filei::_sparse, filei::_tree != 0, !r.count, r.max && !r.stage
+   };
+   unsigned f = 0;
+   for(int b = 0; b < (int)(sizeof(on) / sizeof(*on)); ++b)
+      if (on[b]) f |= 1u << b;
 
-   if (argc > ::optind) { 
-      if (argc >= ::optind +1 && *argv[::optind] == '-') {
-         if (argc > ::optind + 1) {
-            std::cerr << "Spurious arguments!" << std::endl;
-            return 1;
-         }
-         ++optind;
-         comm = false; // read files names from stdin
+   for(int i = 0; i < (int)(sizeof(__conflicts) / sizeof(*__conflicts));
+      ++i) {
+      const __conflict& c = __conflicts[i];
+      if (!(f & c.what)) continue;
+      if (c.needs && !(f & c.needs)) {
+         std::cerr << __named(f & c.what,", ") << " requires "
+                   << __named(c.needs," or ") << "!" << std::endl;
+         return 1;
+      }
+      if (f & c.excludes) {
+         std::cerr << __named(f & c.what,", ") << " does not go with "
+                   << __named(f & c.excludes,", ") << "!" << std::endl;
+         return 1;
       }
    }
 
-   char fileb[1024];
+   if (r.kidx && r.kidx->opts() != __opts(r.ic)) {
+      std::cerr << "--ignore-known requires an index of the same options "
+                << "(-i, --sparse and --tree)!" << std::endl;
+      return 1;
+   }
 
-   for(int i = ::optind;;) {
-      char* file;
-      if (comm) {
-         if (i == argc) break;
-         file = argv[i++];
-      } else {
-         std::cin.getline(fileb,1024);
-         if (std::cin.eof()) break;
-         file = fileb;
-      }
+   r.join = r.lefts.size() || r.rights.size();
+   return 0;
+}
 
+// what the scan leaves to compare
+struct __found {
+   fsetc_t files;
+   fsetk_t known; // archive members (and files of --trust-manifest)
+   eager_t eager; // size groups hashed while the files are stat'ed (-j)
+   size_t emax; // the prefix they are hashed on
+   std::vector<findex::entry> entries; // the files of the index
+};
+
+// stat the files: their size groups (some hashed right away), or the
+// entries of the index
+static void __scan(const __run& r, fstatq::source& src, fstatq* sq,
+   fjournal* jr, const __sketch* sizes, __found& fd) {
+   inodes_t inodes;
+   std::map<size_t,inode_t> firsts; // inode of the only file of a size
+   std::map<size_t,int> sides; // sides of the sizes (--left/--right)
+   // with -2 and archives (or a manifest), the members are fully hashed
+   // and so are these
+   fd.emax = r.stage && (r.archives || r.trust) ? 0 : r.max;
+
+   for(;;) {
+      std::string file;
+      fstatr st;
+      if (__interrupted) break;
+      if (sq) {
+         if (!sq->get(st)) break;
+         file = st.path;
+      } else if (!src.next(file)) break;
 
       try {
-         size_t s = count ? filei::fsize(file) : 0;
+         if (r.archives && ftar::kind(file)) {
+            // members of size groups with members are fully hashed with -2
+            __members(file,fd.files,fd.known,r.count,r.ic,r.iw,
+               r.stage ? 0 : r.max,r.BN,r.v);
+            continue;
+         }
+
+         size_t s;
+         if (jr && jr->size(file,s)); // stat'ed before the run resumed
+         else {
+            if (sq) {
+               if (st.error) throw st.error;
+               s = st.size;
+            } else s = r.count ? filei::fsize(file) : 0;
+            if (jr) jr->stat(file,s);
+         }
+         if (r.shards && freport::shard(s,r.shards) != r.shard) continue;
+         if (sizes && !sizes->twice(s)) continue; // unique size
+         fprogress::done(fprogress::STAT,1,s);
+
+         if (r.index.size()) {
+            __entry(fd.entries,file,s,r.ic,r.BN);
+            if (r.v) std::cerr << "Processed " << file << std::endl;
+            continue;
+         }
+
+         unsigned char md5[16];
+         if (r.trust && r.trust->trusted(file,md5)) { // not read at all
+            fd.known[s].push_back(filei(file,md5));
+            fd.files[s]; // the size group has members
+            if (r.join) sides[s] |= 1 << __side(file,r.lefts,r.rights);
+            if (r.v) std::cerr << "Trusting " << file << std::endl;
+            continue;
+         }
 
-         files[s].push_back(file);
-         if (v) std::cerr << (count ? "Counting " : "Spooling ") 
-                          << file << std::endl;
+         fvec_t& fv = fd.files[s];
+         fv.push_back(file);
+         if (r.join) sides[s] |= 1 << __side(file,r.lefts,r.rights);
+         if (r.v) std::cerr << (r.count ? "Counting " : "Spooling ")
+                            << file << std::endl;
+
+         if (!sq || r.sched || r.automatic || r.join || jr || r.kidx)
+            continue;
+         if (r.count && !s) continue; // empty files are not opened
+
+         // hash the size group from its second member on
+         inode_t in(st.dev,st.ino);
+         if (fv.size() == 1) {
+            firsts[s] = in;
+            continue;
+         }
+         bool v = r.v && !r.count;
+         eager_t::iterator eit = fd.eager.find(s);
+         if (eit == fd.eager.end()) {
+            eit = fd.eager.insert(std::make_pair(s,
+               fset_t(r.ic,r.iw,fd.emax,r.BN))).first;
+            filei::prefetch(file); // read ahead while the first is hashed
+            __eager(eit->second,fv[0],firsts[s],inodes,r.ic,r.iw,fd.emax,
+               r.BN,v);
+            firsts.erase(s);
+         }
+         __eager(eit->second,file,in,inodes,r.ic,r.iw,fd.emax,r.BN,v);
       } catch(const char* e) {
-         if (v) std::cerr << "Skipping " << file << ", " << e << std::endl;
+         if (r.v) std::cerr << "Skipping " << file << ", " << e << std::endl;
          continue;
       }
    }
 
+   if (r.join) { // drop the sizes not on both sides
+      for(fsetc_t::iterator fct = fd.files.begin(); fct != fd.files.end();) {
+         if (sides[fct->first] != 3) fd.files.erase(fct++);
+         else ++fct;
+      }
+   }
+}
+
+// compare the files of the size groups and print the sets (or collect
+// them for the report), with --auto the stages chosen first; the number
+// of size groups left out for the budgets
+static size_t __compare(__run& r, __found& fd, fjournal* jr,
+   std::vector<fgroup>& groups) {
+   // the pairs are hashed too, so that the journal has them
+   bool hp = r.ph || jr;
+
+   if (r.automatic) __auto(fd.files,r.ic,hp,r.stage,r.max,r.BN,r.v);
+
+   const bool ic = r.ic, iw = r.iw, stage = r.stage, count = r.count;
+   const size_t max = r.max, BN = r.BN;
+   const bool v = r.v && !r.count; // of the files
+
+   __totals(fd.files,fd.known,fd.eager,stage,hp,max,r.shard,r.shards);
+
+   std::vector<fsetc_t::const_iterator> order; // of the size groups
+   size_t left = __order(order,fd.files,fd.known,r.payoff,r.bbudget,hp,
+      r.shard,r.shards);
+
+   __ahead* ahead = 0; // the jobs of the groups on the scheduler
+   if (r.sched) {
+      fprogress::watch("io",&__iodepth,r.sched);
+      // the workers hash concurrently, each with its own buffer
+      filei::_gbuff = &::malloc;
+      filei::_relbuff = &::free;
+      filei::_buffc = 0;
+      ahead = new __ahead(*r.sched,order,fd.known,jr,ic,iw,stage,hp,count,
+         max,BN,r.shard,r.shards);
+   }
 
    // iterate over size groups
-   for(fsetc_t::const_iterator fct= files.begin(); fct != files.end(); ++fct) {
-      // less than two in set
-      if (fct->second.size() < 2) continue;
-      // exactly two in set, and don't care about printing hash
-      else if (fct->second.size() == 2 && !ph) {
-         if (filei::eq(fct->second[0],fct->second[1],ic,iw,0,BN)) {
-            std::cout << fct->second[0] << sep << fct->second[1] << std::endl;
-         } 
+   for(size_t g = 0; g < order.size(); ++g) {
+      fsetc_t::const_iterator fct = order[g];
+
+      if (__interrupted) break;
+
+      if (__late() || (r.bbudget && fprogress::bytes() >= r.bbudget)) {
+         left += order.size() - g;
+         break;
+      }
+
+      // archive members of this size
+      fsetk_t::const_iterator kct = fd.known.find(fct->first);
+      size_t nk = kct == fd.known.end() ? 0 : kct->second.size();
+
+      // already hashed (-j)
+      eager_t::iterator eit = fd.eager.find(fct->first);
+      fset_t* ep = eit == fd.eager.end() ? 0 : &eit->second;
+
+      int what = __plan(fct->first,fct->second.size(),nk,ep,hp,r.shard,
+         r.shards);
+      if (!what) continue;
+      else if (what == 1) {
+         bool same = false;
+         const char* error = 0;
+         if (count && !fct->first) same = true; // empty, not opened
+         else if (ahead) {
+            __job* j = ahead->next();
+            same = j->same;
+            error = j->error;
+            delete j;
+         } else try {
+            same = filei::eq(fct->second[0],fct->second[1],ic,iw,0,BN);
+         } catch(const char* e) {
+            error = e;
+         }
+         if (error && v) std::cerr << "Skipping " << fct->second[0]
+            << " and " << fct->second[1] << ", " << error << std::endl;
+         fprogress::done(fprogress::HASH,2,2 * (uint64_t)fct->first);
+         // the left file first
+         int l = r.join ? __side(fct->second[0],r.lefts,r.rights) : 0;
+         if (same) {
+            std::cout << fct->second[l] << r.sep << fct->second[1 - l]
+                      << std::endl;
+         }
          continue;
       }
 
+      // compared by their bytes
+      bool small = !jr && __issmall(fct->first,nk,ep,count,iw);
+
       // these are still candidates
-      fset_t cands(ic,iw,max,BN);
+      size_t m = nk && stage ? 0 : max;
+      fset_t lcands(ic,iw,m,BN);
+      fset_t& cands = ep ? *ep : lcands;
+
+      for(int i = 0; i < (int)nk; ++i) cands.add(kct->second[i]);
+
+      // the files hashed before the run resumed
+      const fvec_t* todo = &fct->second;
+      fvec_t rest;
+      if (jr) {
+         for(int i = 0; i < (int)fct->second.size(); ++i) {
+            const std::string& path = fct->second[i];
+            unsigned char md5[16];
+            if (jr->digest(path,m,md5)) cands.add(filei(path,md5));
+            else rest.push_back(path);
+         }
+         todo = &rest;
+      }
 
       // iterate over same size files
-      for(fvec_t::const_iterator fit = fct->second.begin(); 
-         fit != fct->second.end(); ++fit) {
+      bool cut = false; // the time budget ran out in the group
+      for(fvec_t::const_iterator fit = todo->begin();
+         ahead && !small && fit != todo->end() && !(cut = __late()); ++fit) {
+         __job* j = ahead->next();
+         if (j->error) {
+            if (v) std::cerr << "Skipping " << *fit << ", " << j->error
+                             << std::endl;
+         } else {
+            cands.add(*j->fi);
+            if (jr) jr->hashed(*fit,m,j->fi->md5());
+            if (v) std::cerr << "Processed " << *fit << std::endl;
+         }
+         delete j;
+      }
 
-         try {
-            // add candidate file
-            cands.add(*fit);
-            if (v && !count) std::cerr << "Processed " << *fit << std::endl;
-         } catch(const char* e) {
-            if (v && !count) std::cerr << "Skipping " << *fit 
-               << ", " << e <<  std::endl;
-            continue;
+      // or hash them at once (a slice at a time with a time budget)
+      size_t step = __deadline ? __UAHASHSLICE : todo->size();
+      for(size_t b = 0; !ep && !ahead && !small && b < todo->size() &&
+         !(cut = __late()); b += step) {
+         fvec_t part;
+         if (step < todo->size())
+            part.assign(todo->begin() + b,
+               todo->begin() + std::min(todo->size(),b + step));
+         const fvec_t& slice = step < todo->size() ? part : *todo;
+         std::vector<const char*> errs;
+         if (jr) {
+            std::vector<filei> fis;
+            filei::hashn(slice,ic,iw,m,BN,fis,errs);
+            for(int i = 0; i < (int)fis.size(); ++i) {
+               cands.add(fis[i]);
+               jr->hashed(fis[i].path(),m,fis[i].md5());
+            }
+         } else cands.add(slice,errs);
+         for(int i = 0; v && i < (int)errs.size(); ++i) {
+            if (errs[i]) std::cerr << "Skipping " << slice[i]
+               << ", " << errs[i] <<  std::endl;
+            else std::cerr << "Processed " << slice[i] << std::endl;
          }
       }
 
+      if (cut) {
+         left += order.size() - g;
+         break;
+      }
+
+      if (!ep) {
+         uint64_t b = m ? std::min(fct->first,m) : fct->first;
+         fprogress::done(fprogress::HASH,fct->second.size(),
+            fct->second.size() * b);
+      }
+
       const res_t* resp = 0;
       res_t fres;
-      if (stage) { // if -2
-         try {
+      if (small) {
+         cut = !__smallsets(fres,fct->second,fct->first,ic,v);
+         resp = &fres;
+      } else if (stage && (ep ? fd.emax : !nk)) { // if -2
+         size_t nf = 0;
+         const res_t& cmn = cands.common();
+         for(res_t::const_iterator it = cmn.begin(); it != cmn.end(); ++it)
+            nf += 1 + it->second.size();
+         fprogress::total(fprogress::FULL,nf,nf * (uint64_t)fct->first);
+         if (r.sched || jr || __deadline) {
+            cut = !__common(r.sched,jr,fres,cands.common(),ic,iw,BN,v);
+            resp = &fres;
+         } else try {
             fset_t::common(fres,cands.common(),ic,iw,0,BN);
             resp = &fres;
          } catch(const char* e) {
-            if (v && !count) std::cerr << e <<  std::endl;
+            if (v) std::cerr << e <<  std::endl;
             continue;
          }
+         fprogress::done(fprogress::FULL,nf,nf * (uint64_t)fct->first);
       } else resp = & cands.common();
 
-      fset_t::produce(*resp,std::cout,sep,ph);
+      if (cut) {
+         left += order.size() - g;
+         break;
+      }
+
+      res_t cross;
+      if (r.join) {
+         __cross(cross,*resp,r.lefts,r.rights);
+         resp = &cross;
+      }
+
+      if (r.shards) __collect(groups,*resp,fct->first);
+      else if (r.md5sum) __md5sum(*resp);
+      else fset_t::produce(*resp,std::cout,r.sep,r.ph);
+
+      if (ep) fd.eager.erase(eit);
    }
 
+   delete ahead;
+   fprogress::watch("io",0,0);
+   return left;
+}
+
+// write the report (--shard, --report), or only its changes since the
+// previous one (--diff-against)
+static int __output(const __run& r, std::vector<fgroup>& groups,
+   const freport::header& rh, fdiff* diff) {
+   std::sort(groups.begin(),groups.end());
+   if (diff) {
+      try {
+         for(int i = 0; i < (int)groups.size(); ++i) diff->add(groups[i]);
+         diff->finish();
+         if (r.v) std::cerr << diff->appeared() << " sets appeared, "
+                            << diff->disappeared() << " disappeared, "
+                            << diff->changed() << " changed" << std::endl;
+      } catch(const char* e) {
+         std::cerr << e << " " << r.prev << std::endl;
+         return 1;
+      }
+   } else {
+      freport::write(std::cout,rh);
+      for(int i = 0; i < (int)groups.size(); ++i)
+         freport::write(std::cout,groups[i]);
+   }
+   std::cout.flush();
    return 0;
+}
+
+int main(int argc, char* const * argv) {
+
+   __run r;
+
+   if (argc <= 1) {
+      __phelp(false);
+      return 1;
+   }
+
+   int ret = __parse(r,argc,argv);
+   if (ret >= 0) return ret;
+   if (__check(r,argc,argv)) return 1;
+
+   if (r.bps || r.iops || r.latency) {
+      fthrottle::limit(r.bps,r.iops);
+      fthrottle::adaptive(r.latency);
+      filei::_rdhook = &fthrottle::read;
+   }
+
+   // the status line, or at least the SIGUSR1 dump
+   fprogress::start(r.progress,r.pfile);
+   fprogress::_next = filei::_rdhook;
+   filei::_rdhook = &fprogress::read;
+
+   freport::header rh; // of the report (--shard, --report)
+   rh.shard = r.shard, rh.shards = r.shards;
+   rh.opts = __opts(r.ic);
+
+   std::ifstream pin; // the previous report of --diff-against
+   fdiff* diff = 0;
+   if (r.prev.size()) {
+      try {
+         pin.open(r.prev.c_str());
+         if (!pin.good()) throw "Could not open";
+         diff = new fdiff(pin,std::cout,rh); // checks the shard and options
+      } catch(const char* e) {
+         std::cerr << e << " " << r.prev << std::endl;
+         return 1;
+      }
+   }
+
+   if (r.join) { // the trees of both sides
+      for(int k = 0; k < 2; ++k) {
+         fvec_t& sroots = k ? r.rights : r.lefts;
+         for(int i = 0; i < (int)sroots.size(); ++i) {
+            std::string& rt = sroots[i];
+            while(rt.size() > 1 && rt[rt.size() - 1] == '/')
+               rt.erase(rt.size() - 1);
+            r.roots.push_back(rt);
+         }
+      }
+   }
+
+   if (r.dirs) {
+      ret = __dirs(r.roots,r.manifest,r.ic,r.BN,r.sep,r.ph,r.v);
+      __finish(r.slowest);
+      return ret;
+   }
+
+   if (argc > ::optind) {
+      if (argc >= ::optind +1 && *argv[::optind] == '-') {
+         if (argc > ::optind + 1) {
+            std::cerr << "Spurious arguments!" << std::endl;
+            return 1;
+         }
+         ++optind;
+         r.comm = false; // read files names from stdin
+      }
+   }
+
+   for(int i = 0; i < (int)r.lists.size(); ++i) {
+      if (!std::ifstream(r.lists[i].c_str())) {
+         std::cerr << "Could not open " << r.lists[i] << std::endl;
+         return 1;
+      }
+   }
+
+   if (r.variants) {
+      __names names(::optind,argc,argv,r.comm,r.lists,r.roots);
+      ret = __variants(names,r.max,r.BN,r.sep,r.ph,r.v);
+      __finish(r.slowest);
+      return ret;
+   }
+
+   __sketch* sizes = 0; // --lowmem
+   if (r.lowmem) {
+      sizes = new __sketch((size_t)r.lowmem << 20);
+      __names names(::optind,argc,argv,r.comm,r.lists,r.roots);
+      try {
+         __count(*sizes,names,r.jobs);
+      } catch(const char* e) {
+         std::cerr << e << std::endl;
+         return 1;
+      }
+   }
+
+   fjournal* jr = 0; // --journal
+   if (r.journal.size()) {
+      std::ostringstream os; // what the sizes and the hashes depend on
+      os << __opts(r.ic) << (r.iw ? "w" : "") << (r.count ? "" : "n") << ","
+         << r.max << (r.stage ? ",2" : "");
+      try {
+         jr = new fjournal(r.journal,os.str(),r.resume);
+      } catch(const char* e) {
+         std::cerr << e << " " << r.journal << std::endl;
+         return 1;
+      }
+      __interruptible();
+      if (r.v && r.resume) std::cerr << "Resuming: " << jr->files().size()
+         << " files stat'ed" << (jr->complete() ? " (all)" : "") << ", "
+         << jr->digests() << " hashes" << std::endl;
+   }
+
+   __names names(::optind,argc,argv,r.comm,r.lists,r.roots);
+   __replay replay(jr);
+   __journaled journaled(names,jr);
+   // with all the files stat'ed, their names come from the journal
+   bool replayed = jr && jr->complete();
+   fstatq::source& src = replayed ? (fstatq::source&)replay :
+      (fstatq::source&)journaled;
+
+   fstatq* sq = 0; // the stat pipeline (-j)
+   if (r.jobs && !replayed) {
+      try {
+         sq = new fstatq(src,r.jobs,r.count);
+         fprogress::watch("stat",&__sqdepth,sq);
+      } catch(const char* e) {
+         std::cerr << e << std::endl;
+         return 1;
+      }
+   }
+
+   __found fd;
+   __scan(r,src,sq,jr,sizes,fd);
+
+   fprogress::watch("stat",0,0);
+   delete sq;
+   if (jr && !replayed && !__interrupted) jr->stated();
+   delete sizes;
+
+   if (r.index.size()) {
+      try {
+         findex::write(r.index,fd.entries,__UAIDXPREFIX,__opts(r.ic));
+      } catch(const char* e) {
+         std::cerr << e << " " << r.index << std::endl;
+         return 1;
+      }
+      if (r.v) std::cerr << "Indexed " << fd.entries.size() << " files"
+                         << std::endl;
+      __finish(r.slowest);
+      return 0;
+   }
+
+   if (r.kidx) {
+      __ignore(*r.kidx,fd.files,fd.known,r.ic,r.BN,r.v);
+      if (r.join) __bothsides(fd.files,fd.known,r.lefts,r.rights);
+   }
+
+   std::vector<fgroup> groups; // the report of a shard
+   size_t left = __compare(r,fd,jr,groups);
+
+   if (left) std::cerr << "Budget spent, " << left
+                       << " size groups not compared" << std::endl;
+   if (__interrupted) std::cerr << "Interrupted, --resume goes on from "
+                                << r.journal << std::endl;
+   delete jr;
+
+   ret = __interrupted ? 1 : 0;
+   if (r.shards && !__interrupted) // not a partial report
+      ret = __output(r,groups,rh,diff);
+   delete diff;
+
+   __finish(r.slowest);
+   return ret;
 
 }
@@ -0,0 +1,790 @@
+/*
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.1 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ * 
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See the
+ * License for the specific language governing rights and limitations
+ * under the License.
+ * 
+ * The Original Code was developed for an EU.EDGE internal project and
+ * is made available according to the terms of this license.
+ * 
+ * The Initial Developer of the Original Code is Istvan T. Hernadvolgyi,
+ * EU.EDGE LLC.
+ *
+ * Portions created by EU.EDGE LLC are Copyright (C) EU.EDGE LLC.
+ * All Rights Reserved.
+ *
+ * Alternatively, the contents of this file may be used under the terms
+ * of the GNU General Public License (the "GPL"), in which case the
+ * provisions of GPL are applicable instead of those above.  If you wish
+ * to allow use of your version of this file only under the terms of the
+ * GPL and not to allow others to use your version of this file under the
+ * License, indicate your decision by deleting the provisions above and
+ * replace them with the notice and other provisions required by the GPL.
+ * If you do not delete the provisions above, a recipient may use your
+ * version of this file under either the License or the GPL.
+ */
+
+// FILE COMPARISONS BY MD5 HASH VALUE - DAEMON
+//
+// uad KEEPS THE SETS OF IDENTICAL FILES UNDER SOME DIRECTORIES UP TO DATE
+// AND ANSWERS QUERIES ON A UNIX DOMAIN SOCKET (SEE kua -S)
+//
+// BUILD:
+//
+// g++ -O3 -o uad filei.cc fmd5.cc fprobe.cc finput.cc fwalk.cc uad.cc -I .
+//    -lcrypto -lpthread
+//
+// $ uad -vh
+//
+// will provide help on using the program
+
+#if !defined(__UAD_VERSION)
+#define __UAD_VERSION "1.0"
+#endif
+
+// milliseconds without events after which the files written to in place
+// (without a close) are hashed again
+//
+#if !defined(__UADSETTLE)
+#define __UADSETTLE 1000
+#endif
+
+// longest request line taken from a client (a HAVE with a long path)
+//
+#if !defined(__UADLINE)
+#define __UADLINE (PATH_MAX + 16)
+#endif
+
+// bytes of answers queued for a client before its requests are no longer
+// read (until it reads them)
+//
+#if !defined(__UADQUEUE)
+#define __UADQUEUE (1 << 20)
+#endif
+
+#include <filei.h>
+#include <fwalk.h>
+
+#include <sstream>
+
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/vfs.h>
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+}
+
+static char __help[] =
+"uad [OPTION]... -S <socket> DIR...\n\n"
+"where OPTION is\n"
+"  -S <socket>: UNIX domain socket to listen on\n"
+"  -m <mode>:   permissions of the socket (octal, default 600)\n"
+"  -i:          ignore case\n"
+"  -w:          ignore white space\n"
+"  -n:          do not ask the FS for file size\n"
+"  -I:          watch with inotify even if fanotify is available\n"
+"  -v:          verbose output (prints stuff to stderr), verbose help\n"
+"  -b <bsize>:  set internal buffer size (default 1024)\n"
+"  -h:          this help (-vh more verbose help)\n";
+
+static char __vhelp[] =
+"uad walks the directories once, groups the files by size and hashes\n"
+"the ones whose size is not unique, exactly like ua would. Then it keeps\n"
+"watching the trees and updates the size groups and the hashes of the\n"
+"files that change, are created, removed or moved. The index is kept in\n"
+"memory only.\n\n"
+"When run with enough privileges (CAP_SYS_ADMIN) the file systems are\n"
+"watched with fanotify, otherwise (or with -I) every directory gets an\n"
+"inotify watch (see /proc/sys/fs/inotify/max_user_watches).\n\n"
+"Requests are single lines on the socket, each answer is terminated by\n"
+"an empty line:\n\n"
+"  HAVE <path>   the files identical to <path> (<path> itself excluded),\n"
+"                one per line\n"
+"  GROUPS        the sets of identical files, one per line as ua prints\n"
+"  STATS         number of files, size groups and hashed files\n\n"
+"Errors are reported on a line starting with ERR.\n\n"
+"Examples.\n\n"
+"  $ uad -S /run/uad.sock /srv/archive &\n"
+"  $ kua -S /run/uad.sock -f upload.bin\n\n"
+"Blame\n\n"
+"  istvan.hernadvolgyi@gmail.com\n\n";
+
+
+static void __phelp(bool v) {
+   if (v) {
+      std::cout << "Keep sets of identical files up to date."
+                << std::endl << std::endl
+                << __help << std::endl << __vhelp
+                << "Version: " << __UAD_VERSION
+                << std::endl << std::endl;
+   } else {
+      std::cout << __help << std::endl
+                << "version: " << __UAD_VERSION
+                << std::endl << std::endl
+                << "Type uad -vh for more help." << std::endl;
+   }
+   std::cout.flush();
+}
+
+/** Index of identical files.
+ *
+ * The same steps as ua, but incremental: files are kept in groups by
+ * size and a file is hashed as soon as its size group has at least
+ * two members. Files can be removed and re-added as they change.
+ *
+ * It does not use fsetc_t and fset: these only grow (a size group is a
+ * vector, an fset has no removal), while here a file leaves its groups
+ * whenever it changes and a directory removed takes all the files under
+ * it, found by the prefix of their paths in an ordered map.
+ */
+class __dindex {
+   private:
+
+      struct entry {
+         off_t size;     // size (0 when not counting)
+         off_t bytes;    // size in bytes when indexed
+         struct timespec mtime; // modification time when indexed
+         bool hashed;    // whether _md5 is valid
+         unsigned char md5[16];
+      };
+
+      typedef std::map<std::string,entry> files_t; // path -> entry
+      typedef std::set<std::string> paths_t;
+      typedef std::map<off_t,paths_t> sizes_t; // size -> paths
+      typedef std::map<std::string,paths_t> groups_t; // md5 -> paths
+
+      files_t _files;
+      sizes_t _sizes;
+      groups_t _groups;
+
+      bool _ic; // ignore case
+      bool _iw; // ignore white space
+      bool _count; // group by size
+      size_t _bs; // buffer size
+      bool _v; // verbose
+
+      // hash a file unless already done, false if it could not be hashed
+      bool digest(files_t::iterator it) {
+         if (it->second.hashed) return true;
+         try {
+            filei fi(it->first,_ic,_iw,0,_bs);
+            ::memcpy(it->second.md5,fi.md5(),16);
+            it->second.hashed = true;
+            _groups[std::string((const char*)fi.md5(),16)].insert(it->first);
+            if (_v) std::cerr << "Hashed " << it->first << std::endl;
+            return true;
+         } catch(const char* e) {
+            if (_v) std::cerr << "Skipping " << it->first << ", " << e
+                              << std::endl;
+         }
+         return false;
+      }
+
+      // hash a file just added to its size group: the other members of a
+      // group of two or more are hashed already, but for the one before
+      // it when the group has just grown to two
+      void digest(const std::string& path, off_t size) {
+         const paths_t& ps = _sizes[size];
+         if (ps.size() < 2) return;
+
+         fvec_t todo(1,path), bad;
+         if (ps.size() == 2)
+            todo.push_back(*ps.begin() == path ? *ps.rbegin() : *ps.begin());
+         for(int i = 0; i < (int)todo.size(); ++i)
+            if (!digest(_files.find(todo[i]))) bad.push_back(todo[i]);
+         for(int i = 0; i < (int)bad.size(); ++i) drop(bad[i]);
+      }
+
+      // whether a file is as it was when indexed
+      static bool same(const entry& e, const struct stat& st) {
+         return e.bytes == st.st_size && e.mtime.tv_sec == st.st_mtim.tv_sec &&
+            e.mtime.tv_nsec == st.st_mtim.tv_nsec;
+      }
+
+      // remove one entry
+      void erase(files_t::iterator it) {
+         sizes_t::iterator sit = _sizes.find(it->second.size);
+         sit->second.erase(it->first);
+         if (sit->second.empty()) _sizes.erase(sit);
+
+         if (it->second.hashed) {
+            groups_t::iterator git =
+               _groups.find(std::string((const char*)it->second.md5,16));
+            git->second.erase(it->first);
+            if (git->second.empty()) _groups.erase(git);
+         }
+         _files.erase(it);
+      }
+
+   public:
+
+      __dindex(bool ic, bool iw, bool count, size_t bs, bool v):
+         _ic(ic), _iw(iw), _count(count), _bs(bs), _v(v) {
+      }
+
+      /** Add a regular file.
+        * @param path file
+        * @param st its status
+        */
+      void add(const std::string& path, const struct stat& st) {
+         drop(path);
+
+         entry& e = _files[path];
+         e.size = _count ? st.st_size : 0;
+         e.bytes = st.st_size;
+         e.mtime = st.st_mtim;
+         e.hashed = false;
+
+         _sizes[e.size].insert(path);
+         if (_v) std::cerr << "Counting " << path << std::endl;
+         digest(path,e.size);
+      }
+
+      /** Remove a file or everything under a directory.
+        * @param path file or directory
+        */
+      void drop(const std::string& path) {
+         files_t::iterator it = _files.find(path);
+         if (it != _files.end()) erase(it);
+
+         std::string pre = path + "/";
+         for(it = _files.lower_bound(pre); it != _files.end() &&
+            !it->first.compare(0,pre.size(),pre);) erase(it++);
+      }
+
+      /** Answer a HAVE request.
+        * @param path the file to look for
+        * @param os the answer (returned)
+        */
+      void have(const std::string& path, std::ostream& os) {
+         struct stat st;
+         if (::stat(path.c_str(),&st) || !S_ISREG(st.st_mode)) {
+            os << "ERR Could not stat file." << std::endl;
+            return;
+         }
+
+         off_t size = _count ? st.st_size : 0;
+         sizes_t::const_iterator sit = _sizes.find(size);
+         if (sit == _sizes.end()) return;
+         if (sit->second.size() == 1 && sit->second.count(path)) return;
+
+         std::string key;
+         files_t::iterator it = _files.find(path);
+         if (it != _files.end() && it->second.hashed && same(it->second,st)) {
+            key.assign((const char*)it->second.md5,16);
+         } else {
+            try {
+               filei fi(path,_ic,_iw,0,_bs);
+               key.assign((const char*)fi.md5(),16);
+            } catch(const char* e) {
+               os << "ERR " << e << std::endl;
+               return;
+            }
+         }
+
+         // a lone member has not been hashed yet
+         if (sit->second.size() == 1) {
+            files_t::iterator lit = _files.find(*sit->second.begin());
+            if (!digest(lit)) return;
+         }
+
+         groups_t::const_iterator git = _groups.find(key);
+         if (git == _groups.end()) return;
+
+         // the watches may lag behind, don't report what has changed since
+         fvec_t stale;
+         for(paths_t::const_iterator pit = git->second.begin();
+            pit != git->second.end(); ++pit) {
+            if (*pit == path) continue;
+            struct stat pst;
+            if (::stat(pit->c_str(),&pst) || !same(_files[*pit],pst)) 
+               stale.push_back(*pit);
+            else os << *pit << std::endl;
+         }
+         for(int i = 0; i < (int)stale.size(); ++i) update(stale[i]);
+      }
+
+      /** Print the sets of identical files.
+        * @param os output stream
+        */
+      void groups(std::ostream& os) const {
+         for(groups_t::const_iterator git = _groups.begin();
+            git != _groups.end(); ++git) {
+            if (git->second.size() < 2) continue;
+            for(paths_t::const_iterator pit = git->second.begin();
+               pit != git->second.end(); ++pit) {
+               if (pit != git->second.begin()) os << " ";
+               os << *pit;
+            }
+            os << std::endl;
+         }
+      }
+
+      /** Print some numbers.
+        * @param os output stream
+        */
+      void stats(std::ostream& os) const {
+         size_t h = 0;
+         for(groups_t::const_iterator git = _groups.begin();
+            git != _groups.end(); ++git) h += git->second.size();
+         os << "files " << _files.size() << std::endl
+            << "sizes " << _sizes.size() << std::endl
+            << "hashed " << h << std::endl;
+      }
+
+      /** Re-examine a path that has changed (or is gone).
+        * @param path file or directory
+        * @return true if path is a directory that needs to be scanned
+        */
+      bool update(const std::string& path) {
+         drop(path);
+
+         struct stat st;
+         if (::lstat(path.c_str(),&st)) return false;
+         if (S_ISDIR(st.st_mode)) return true;
+         if (S_ISREG(st.st_mode)) add(path,st);
+         return false;
+      }
+};
+
+// the roots being watched (absolute paths)
+static std::vector<std::string> __roots;
+
+// inotify descriptor (or -1) and its watches
+static int __ifd = -1;
+static std::map<int,std::string> __wds;
+
+// whether path is under one of the roots
+static bool __under(const std::string& path) {
+   for(int i = 0; i < (int)__roots.size(); ++i) {
+      const std::string& r = __roots[i];
+      if (!path.compare(0,r.size(),r) &&
+         (path.size() == r.size() || path[r.size()] == '/' || r == "/"))
+         return true;
+   }
+   return false;
+}
+
+// add a tree to the index (and to the inotify watches)
+static void __scan(__dindex& idx, const std::string& root) {
+   fwalk w(root,true);
+   std::string path;
+   struct stat st;
+   while(w.next(path,&st)) {
+      if (S_ISREG(st.st_mode)) idx.add(path,st);
+      else if (__ifd >= 0) {
+         int wd = ::inotify_add_watch(__ifd,path.c_str(),
+            IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | 
+            IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DONT_FOLLOW | 
+            IN_ONLYDIR);
+         if (wd >= 0) __wds[wd] = path;
+      }
+   }
+}
+
+// files written to in place (IN_MODIFY, FAN_MODIFY) and not closed yet:
+// hashed again once the events settle (or before an answer), not on
+// every write
+static std::set<std::string> __dirty;
+
+// a path has changed
+static void __update(__dindex& idx, const std::string& path) {
+   __dirty.erase(path);
+   if (idx.update(path)) __scan(idx,path);
+}
+
+// a path has changed: the bytes only (modify) or more
+static void __changed(__dindex& idx, const std::string& path, bool modify,
+   bool v) {
+   if (modify) { __dirty.insert(path); return; }
+   if (v) std::cerr << "Changed " << path << std::endl;
+   __update(idx,path);
+}
+
+// update the files written to in place
+static void __settle(__dindex& idx, bool v) {
+   while(!__dirty.empty()) {
+      std::string path = *__dirty.begin();
+      if (v) std::cerr << "Changed " << path << std::endl;
+      __update(idx,path);
+   }
+}
+
+// lost events, start over
+static void __rescan(__dindex& idx, bool v) {
+   if (v) std::cerr << "Events lost, rescanning" << std::endl;
+   for(int i = 0; i < (int)__roots.size(); ++i) {
+      idx.drop(__roots[i]);
+      __scan(idx,__roots[i]);
+   }
+}
+
+static void __inotify_events(__dindex& idx, bool v) {
+   char buff[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+   for(;;) {
+      ssize_t n = ::read(__ifd,buff,sizeof(buff));
+      if (n <= 0) return;
+
+      for(char* p = buff; p < buff + n;) {
+         const struct inotify_event* e = (const struct inotify_event*)p;
+         p += sizeof(struct inotify_event) + e->len;
+
+         if (e->mask & IN_Q_OVERFLOW) { __rescan(idx,v); continue; }
+         if (e->mask & IN_IGNORED) { __wds.erase(e->wd); continue; }
+
+         std::map<int,std::string>::const_iterator wit = __wds.find(e->wd);
+         if (wit == __wds.end() || !e->len) continue;
+
+         std::string path = wit->second + "/" + e->name;
+         __changed(idx,path,!(e->mask & ~IN_MODIFY),v);
+      }
+   }
+}
+
+#if defined(FAN_REPORT_DFID_NAME)
+
+// fanotify descriptor (or -1) and a descriptor per watched file system
+// for open_by_handle_at
+static int __ffd = -1;
+static std::vector<std::pair<fsid_t,int> > __mfds;
+
+// watch the file systems of the roots, -1 if fanotify cannot be used
+static int __fanotify_init() {
+   __ffd = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK |
+      FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+   if (__ffd < 0) return -1;
+
+   for(int i = 0; i < (int)__roots.size(); ++i) {
+      struct statfs sfs;
+      int mfd = ::open(__roots[i].c_str(),O_RDONLY | O_DIRECTORY);
+      if (mfd < 0 || ::fstatfs(mfd,&sfs) || ::fanotify_mark(__ffd,
+         FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FAN_CLOSE_WRITE | FAN_MODIFY |
+         FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | 
+         FAN_ATTRIB | FAN_ONDIR,
+         mfd,0)) {
+         if (mfd >= 0) ::close(mfd);
+         for(int j = 0; j < (int)__mfds.size(); ++j) ::close(__mfds[j].second);
+         __mfds.clear();
+         ::close(__ffd);
+         return __ffd = -1;
+      }
+      __mfds.push_back(std::make_pair(sfs.f_fsid,mfd));
+   }
+
+   return __ffd;
+}
+
+static void __fanotify_events(__dindex& idx, bool v) {
+   char buff[16384] __attribute__((aligned(8)));
+
+   for(;;) {
+      ssize_t n = ::read(__ffd,buff,sizeof(buff));
+      if (n <= 0) return;
+
+      struct fanotify_event_metadata* m =
+         (struct fanotify_event_metadata*)buff;
+      for(; FAN_EVENT_OK(m,n); m = FAN_EVENT_NEXT(m,n)) {
+         if (m->mask & FAN_Q_OVERFLOW) { __rescan(idx,v); continue; }
+
+         struct fanotify_event_info_fid* fid =
+            (struct fanotify_event_info_fid*)(m + 1);
+         if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) continue;
+
+         struct file_handle* fh = (struct file_handle*)fid->handle;
+         const char* name = (const char*)(fh->f_handle + fh->handle_bytes);
+
+         int mfd = -1;
+         for(int i = 0; i < (int)__mfds.size(); ++i) {
+            if (!::memcmp(&__mfds[i].first,&fid->fsid,sizeof(fsid_t))) {
+               mfd = __mfds[i].second;
+               break;
+            }
+         }
+         if (mfd < 0) continue;
+
+         // the directory of the event
+         int dfd = ::open_by_handle_at(mfd,fh,O_RDONLY | O_PATH);
+         if (dfd < 0) continue;
+         char proc[64], dir[PATH_MAX];
+         ::snprintf(proc,sizeof(proc),"/proc/self/fd/%d",dfd);
+         ssize_t k = ::readlink(proc,dir,sizeof(dir) - 1);
+         ::close(dfd);
+         if (k <= 0) continue;
+         dir[k] = 0;
+
+         std::string path(dir);
+         if (::strcmp(name,".")) {
+            if (path != "/") path += "/";
+            path += name;
+         }
+         if (!__under(path)) continue;
+
+         __changed(idx,path,!(m->mask & ~FAN_MODIFY),v);
+      }
+   }
+}
+
+#endif
+
+// answer a request
+static std::string __answer(__dindex& idx, const std::string& req) {
+   std::ostringstream os;
+
+   __settle(idx,false); // answer from the files as they are
+   if (!req.compare(0,5,"HAVE ")) idx.have(req.substr(5),os);
+   else if (req == "GROUPS") idx.groups(os);
+   else if (req == "STATS") idx.stats(os);
+   else os << "ERR Unknown request." << std::endl;
+
+   os << std::endl;
+   return os.str();
+}
+
+// a client: its socket (non-blocking), the requests read and not yet
+// answered, the answers not yet written and whether it has sent all
+struct __client {
+   int fd;
+   std::string in, out;
+   bool eof;
+
+   __client(int f): fd(f), eof(false) {}
+};
+
+// answer the requests of a client while its queue has room
+static void __serve(__dindex& idx, __client& c) {
+   for(std::string::size_type e; c.out.size() < __UADQUEUE && 
+      (e = c.in.find('\n')) != std::string::npos;) {
+      std::string req = c.in.substr(0,e);
+      c.in.erase(0,e + 1);
+      c.out += __answer(idx,req);
+   }
+}
+
+// read the requests of a client, false if it has sent a line too long
+static bool __read(__dindex& idx, __client& c) {
+   char buff[4096];
+   ssize_t n = ::read(c.fd,buff,sizeof(buff));
+   if (n < 0 && (errno == EINTR || errno == EAGAIN)) return true;
+   if (n <= 0) {
+      c.eof = true;
+      return true;
+   }
+
+   c.in.append(buff,n);
+   __serve(idx,c);
+   std::string::size_type e = c.in.rfind('\n');
+   return c.in.size() - (e == std::string::npos ? 0 : e + 1) <= __UADLINE;
+}
+
+// write what a client takes of its answers, false if it is gone
+static bool __write(__dindex& idx, __client& c) {
+   ssize_t k = ::write(c.fd,c.out.data(),c.out.size());
+   if (k < 0) return errno == EINTR || errno == EAGAIN;
+   c.out.erase(0,k);
+   __serve(idx,c); // the requests held back while the queue was full
+   return true;
+}
+
+static volatile sig_atomic_t __done = 0;
+
+static void __stop(int) { __done = 1; }
+
+int main(int argc, char* const * argv) {
+
+   std::string sock; // socket path
+
+   bool ic = false; // ignore case
+   bool iw = false; // ignore white space
+   bool v = false; // verbose
+   int BN = 1024; // buffer size
+   bool count = true; // take size into account
+   bool inotify = false; // prefer inotify
+   mode_t mode = 0600; // of the socket
+
+   if (argc <= 1) {
+      __phelp(false);
+      return 1;
+   }
+
+   int opt;
+   while((opt = ::getopt(argc,argv,"S:hb:viwnIm:")) != -1) {
+      switch(opt) {
+         case 'S':
+            sock = std::string(::optarg);
+            break;
+         case 'b':
+            BN = ::atoi(::optarg);
+            if (!BN) {
+               std::cerr << "Invalid buffer size " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         case 'i':
+            ic = true;
+            break;
+         case 'v':
+            v = true;
+            break;
+         case 'w':
+            iw = true;
+            break;
+         case 'n':
+            count = false;
+            break;
+         case 'I':
+            inotify = true;
+            break;
+         case 'm': {
+            char* e = 0;
+            mode = ::strtol(::optarg,&e,8);
+            if (*e || mode & ~0777) {
+               std::cerr << "Invalid mode " << ::optarg << std::endl;
+               return 1;
+            }
+            break;
+         }
+         case 'h':
+            __phelp(v);
+            return 0;
+         case '?':
+            std::cerr << "Type " << argv[0] << " -h for options." << std::endl;
+            return 1;
+      }
+   }
+
+   if (!sock.size()) {
+      std::cerr << "Socket param missing. See uad -vh" << std::endl;
+      return 1;
+   }
+
+   if (::optind == argc) {
+      std::cerr << "No directories to watch. See uad -vh" << std::endl;
+      return 1;
+   }
+
+   if (count && iw) count = false;
+
+   for(int i = ::optind; i < argc; ++i) {
+      char rp[PATH_MAX];
+      if (!::realpath(argv[i],rp)) {
+         std::cerr << "Could not resolve " << argv[i] << std::endl;
+         return 1;
+      }
+      __roots.push_back(rp);
+   }
+
+   // listen
+   struct sockaddr_un addr;
+   ::memset(&addr,0,sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if (sock.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "Socket path too long" << std::endl;
+      return 1;
+   }
+   ::strcpy(addr.sun_path,sock.c_str());
+
+   // created with no more than owner access, then given the mode
+   int lfd = ::socket(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0);
+   ::unlink(sock.c_str());
+   mode_t um = ::umask(0177);
+   bool bound = lfd >= 0 && !::bind(lfd,(struct sockaddr*)&addr,sizeof(addr));
+   ::umask(um);
+   if (!bound || ::chmod(sock.c_str(),mode) || ::listen(lfd,16)) {
+      std::cerr << "Could not listen on " << sock << std::endl;
+      return 1;
+   }
+
+   // watch
+   int wfd = -1;
+#if defined(FAN_REPORT_DFID_NAME)
+   if (!inotify) wfd = __fanotify_init();
+#endif
+   if (wfd < 0) {
+      wfd = __ifd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (__ifd < 0) {
+         std::cerr << "Could not watch the directories" << std::endl;
+         return 1;
+      }
+   }
+   if (v) std::cerr << "Watching with " << (__ifd < 0 ? "fanotify" : "inotify")
+                    << std::endl;
+
+   // build the index
+   __dindex idx(ic,iw,count,BN,v);
+   for(int i = 0; i < (int)__roots.size(); ++i) __scan(idx,__roots[i]);
+   if (v) std::cerr << "Ready" << std::endl;
+
+   ::signal(SIGPIPE,SIG_IGN);
+   ::signal(SIGINT,&__stop);
+   ::signal(SIGTERM,&__stop);
+
+   std::vector<__client> clients;
+
+   while(!__done) {
+      std::vector<struct pollfd> fds(2 + clients.size());
+      fds[0].fd = lfd, fds[0].events = POLLIN;
+      fds[1].fd = wfd, fds[1].events = POLLIN;
+      for(int i = 0; i < (int)clients.size(); ++i) {
+         const __client& c = clients[i];
+         fds[2 + i].fd = c.fd;
+         fds[2 + i].events = (c.eof || c.out.size() >= __UADQUEUE ? 
+            0 : POLLIN) | (c.out.empty() ? 0 : POLLOUT);
+      }
+
+      int k = ::poll(&fds[0],fds.size(),__dirty.empty() ? -1 : __UADSETTLE);
+      if (k < 0) continue;
+      if (!k) __settle(idx,v); // quiet
+
+      if (fds[1].revents) {
+#if defined(FAN_REPORT_DFID_NAME)
+         if (__ffd >= 0) __fanotify_events(idx,v);
+         else
+#endif
+         __inotify_events(idx,v);
+      }
+
+      for(int i = (int)clients.size() - 1; i >= 0; --i) {
+         short re = fds[2 + i].revents;
+         if (!re) continue;
+
+         __client& c = clients[i];
+         bool ok = true;
+         if (re & POLLOUT) ok = __write(idx,c);
+         if (ok && !c.eof && re & (POLLIN | POLLHUP | POLLERR)) 
+            ok = __read(idx,c);
+         if (!ok || (c.eof && c.out.empty()) || (re & POLLERR)) {
+            ::close(c.fd);
+            clients.erase(clients.begin() + i);
+         }
+      }
+
+      if (fds[0].revents) {
+         int cfd = ::accept4(lfd,0,0,SOCK_CLOEXEC | SOCK_NONBLOCK);
+         if (cfd >= 0) clients.push_back(__client(cfd));
+      }
+   }
+
+   for(int i = 0; i < (int)clients.size(); ++i) ::close(clients[i].fd);
+
+   ::close(lfd);
+   ::unlink(sock.c_str());
+
+   return 0;
+}